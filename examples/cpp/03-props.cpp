@@ -45,8 +45,12 @@ public:
         std::cout << "Entity deleted: " << p->classes->by_index(ent->cls).key << " (" << ent->cls << ")" << std::endl;
 
         std::cout << "=========================" << std::endl;
-        for (auto &p : ent->properties) {
-            std::cout << p.second->info->name << " " << p.second->as_string() << std::endl;
+        for (uint32_t i = 0; i < ent->properties.size(); ++i) {
+            if (!ent->is_set(i))
+                continue;
+
+            const fs* f = ent->layout->fields[i];
+            std::cout << ent->layout->name(i) << " " << ent->properties[i].as_string(f->type) << std::endl;
         }
         std::cout << std::endl;
     }
@@ -53,8 +53,8 @@ class visitor(butterpy.visitor):
         print("=======================")
 
         # Print all entity attributes
-        for prop in entity.properties:
-            print("{:s} - {}".format(entity.properties[prop].info.name, entity.properties[prop].value()))
+        for prop in entity.keys():
+            print("{:s} - {}".format(prop, entity.value(prop)))
 
         # Newline after each entity
         print("")
@@ -186,15 +186,11 @@ EMSCRIPTEN_BINDINGS(butterfly) {
         ), allow_raw_pointer<arg<0>>())
         .function("get", select_overload<fs* (fs&, int)>(
             [](fs& f, int i) -> fs* {
-                if ( f.info->dynamic && f.properties.size() == 1 ) {
-                    return &f.properties[0];
-                }
-
-                if (i >= f.properties.size()) {
+                if (!f.elements && i >= f.size()) {
                     return nullptr;
                 }
 
-                return &f.properties[i];
+                return const_cast<fs*>(&f.child(i));
             }
         ), allow_raw_pointer<arg<0>>());
 
@@ -225,7 +221,7 @@ EMSCRIPTEN_BINDINGS(butterfly) {
         ))
         .function("serializers", select_overload<flattened_serializer* (parser&)>(
             [](parser& p) {
-                return p.serializers;
+                return const_cast<flattened_serializer*>(p.serializers.get());
             }
         ), allow_raw_pointer<arg<0>>())
         .property("particle_manager", &parser::particles)
@@ -240,7 +236,7 @@ EMSCRIPTEN_BINDINGS(butterfly) {
         .function("entity", select_overload<jsEntity (parser&, uint32_t i)>(
             [](parser& p, uint32_t i) {
                 entity* e = p.entities[i];
-                return jsEntity(e);
+                return jsEntity(e, &p.resources);
             }
         ))
         .function("open", select_overload<void (parser&, std::string path, jsVisitor*)>(
@@ -252,7 +248,13 @@ EMSCRIPTEN_BINDINGS(butterfly) {
         .function("parse", &parser::parse, allow_raw_pointer<arg<0>>())
         .function("parse_all", &parser::parse_all, allow_raw_pointer<arg<0>>())
         .function("require", &parser::require)
-        .function("seek", &parser::seek);
+        .function("seek", &parser::seek)
+        .function("resource", select_overload<std::string (parser&, std::string)>(
+            [](parser& p, std::string hash) {
+                // hashes are passed as decimal strings, see property.value
+                return p.resources.get(std::stoull(hash));
+            }
+        ));
 
     enum_<parser::state>("parser_state")
         .value("BEGIN", parser::state::BEGIN)
@@ -275,7 +277,8 @@ EMSCRIPTEN_BINDINGS(butterfly) {
         .value("V_UINT64", property::V_UINT64)
         .value("V_FLOAT", property::V_FLOAT)
         .value("V_STRING", property::V_STRING)
-        .value("V_VECTOR", property::V_VECTOR);
+        .value("V_VECTOR", property::V_VECTOR)
+        .value("V_RESOURCE", property::V_RESOURCE);
 
     class_<jsProperty>("property")
         .function("type", &jsProperty::type)
@@ -306,6 +309,9 @@ EMSCRIPTEN_BINDINGS(butterfly) {
 
                     return rv;
                 };
+                // hash as a decimal string, resolve it with parser.resource
+                case property::V_RESOURCE:
+                    return val(std::to_string(p.data().u64));
                 default:
                     return val::null();
                 }
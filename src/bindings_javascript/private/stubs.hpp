@@ -37,25 +37,26 @@ namespace butterfly {
     /** Wrapper around property */
     class jsProperty {
     public:
-        jsProperty(property* p) : m_p(p) {}
+        jsProperty(property* p, const fs* f) : m_p(p), m_f(f) {}
 
-        auto type() -> decltype(property::type) {
-            return m_p->type;
+        uint8_t type() {
+            return m_f->type;
         }
 
         auto data() -> decltype(property::data) {
             return m_p->data;
         }
 
-        auto data_str() -> decltype(property::data_str) {
-            return m_p->data_str;
+        std::string data_str() {
+            return std::string(m_p->c_str(), m_p->data.str.size);
         }
 
-        auto info() -> decltype(property::info) {
-            return m_p->info;
+        const fs* info() {
+            return m_f;
         }
     private:
         property* m_p;
+        const fs* m_f;
     };
 
     /** Wrapper around entity */
@@ -65,7 +66,7 @@ namespace butterfly {
             uint64_t hash;
         };
 
-        jsEntity(entity* e) : m_e(e) {}
+        jsEntity(entity* e, resource_cache* r = nullptr) : m_e(e), m_r(r) {}
 
         bool valid() {
             return (m_e != nullptr);
@@ -88,12 +89,12 @@ namespace butterfly {
         }
 
         void spew() {
-            m_e->spew();
+            m_e->spew(std::cout, m_r);
         }
 
         std::string spew_string() {
             std::stringstream s("");
-            m_e->spew(s);
+            m_e->spew(s, m_r);
             return s.str();
         }
 
@@ -106,25 +107,28 @@ namespace butterfly {
         }
 
         jsProperty get(std::string s) {
-            return jsProperty(m_e->get(s));
+            return jsProperty(m_e->get(s), m_e->field(s));
         }
 
         jsProperty get_by_hash(jsPropHash h) {
-            return jsProperty(m_e->get(h.hash));
+            return jsProperty(m_e->get(h.hash), m_e->field(h.hash));
         }
 
         std::vector<jsPropHash> properties() {
             std::vector<jsPropHash> ret;
             ret.reserve(m_e->properties.size());
 
-            for (auto &e : m_e->properties) {
-                ret.push_back({e.first});
+            for (uint32_t i = 0; i < m_e->properties.size(); ++i) {
+                if (m_e->is_set(i))
+                    ret.push_back({m_e->layout->fields[i]->hash});
             }
 
             return ret;
         }
     private:
         entity* m_e;
+        /** Resolves resource paths when spewing, null if the entity doesn't come from a parser */
+        resource_cache* m_r;
     };
 
     /** Wrapper around visitor */
@@ -146,7 +150,7 @@ namespace butterfly {
         }
 
         void on_entity( entity_state state, entity* ent ) {
-            return call<void>("on_entity", state, jsEntity(ent));
+            return call<void>("on_entity", state, jsEntity(ent, p ? &p->resources : nullptr));
         }
 
         void on_tick( int32_t tick ) {
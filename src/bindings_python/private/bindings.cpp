@@ -36,6 +36,47 @@ using namespace butterfly;
 namespace py = pybind11;
 
 namespace butterfly {
+    /** Converts a property cell to a python object, the type is provided by the serializer */
+    py::object property_value(const property& p, uint8_t type) {
+        switch ( type ) {
+        case property::V_BOOL:
+            return py::object( py::bool_(p.data.b) );
+        case property::V_INT32:
+            return py::object( py::int_(p.data.i32) );
+        case property::V_INT64:
+            return py::object( py::int_(p.data.i64) );
+        case property::V_UINT32:
+            return py::object( py::int_(p.data.u32) );
+        case property::V_UINT64:
+            return py::object( py::int_(p.data.u64) );
+        case property::V_FLOAT:
+            return py::object( py::float_(p.data.fl) );
+        case property::V_STRING:
+            return py::object( py::str(p.c_str(), p.data.str.size) );
+        case property::V_VECTOR: {
+            py::list r(3);
+            r[0] = py::float_(p.data.vec[0]);
+            r[1] = py::float_(p.data.vec[1]);
+            r[2] = py::float_(p.data.vec[2]);
+
+            return py::object(r);
+        };
+        case property::V_ARRAY:
+            return py::object( py::int_(p.data.arr.size) );
+        case property::V_RESOURCE:
+            return py::object( py::int_(p.data.u64) );
+        case property::V_QUATERNION: {
+            py::list r(4);
+            for (uint32_t i = 0; i < 4; ++i)
+                r[i] = py::float_(p.data.quat[i]);
+
+            return py::object(r);
+        };
+        default:
+            return py::object( py::str("Unkown") );
+        }
+    }
+
     /** Create a binding for a dictionary */
     template <typename T, typename... Args>
     pybind11::class_<dict<T>> bind_dict(pybind11::module &m, std::string const &name, Args&&... args) {
@@ -169,16 +210,35 @@ PYBIND11_PLUGIN(butterpy) {
     /// ----------------------------------------------------------------
 
     py::class_<entity> py_entity(m, "entity");
-    py_entity.def_readonly("properties", &entity::properties, "Properties, indexes by their hash")
-        .def_readonly("id", &entity::id, "Own entity ID in global list")
+    py_entity.def_readonly("id", &entity::id, "Own entity ID in global list")
+        .def_readonly("serial", &entity::serial, "Serial number of the slot")
+        .def("handle", &entity::handle, "Networked handle referencing this entity")
         .def_readonly("cls_hash", &entity::cls_hash, "Class hash")
         .def("cls", [](entity& e) { return e.cls; }, "Class id")
         .def("type", [](entity& e) { return e.type; }, "Type")
         .def("set_serializer", &entity::set_serializer, "Set reference serialzier")
-        .def("parse", &entity::parse, "Parse entity data from bitstream")
         .def("spew", &entity::spew, "Spew property to console")
         .def("has", (bool (entity::*)(const std::string &)) &entity::has, "Returns true if field exists")
-        .def("get", (property* (entity::*)(const std::string &)) &entity::get, "Get field by its hash", py::return_value_policy::reference);
+        .def("keys", [](entity& e) {
+            std::vector<std::string> r;
+            for (uint32_t i = 0; i < e.properties.size(); ++i) {
+                if (e.is_set(i))
+                    r.push_back(e.layout->name(i));
+            }
+            return r;
+        }, "Returns the names of all received properties")
+        .def("value", [](entity& e, const std::string& s) {
+            return property_value(*e.get(s), e.field(s)->type);
+        }, "Returns the property value by name");
+        .def("element", [](entity& e, const std::string& a, uint32_t idx, const std::string& f) {
+            const fs* arr = e.field(a);
+            const uint32_t slot = arr->elements->find(constexpr_hash_rt(f.c_str()));
+            if (slot == fs_layout::npos)
+                throw pybind11::key_error();
+
+            const fs* el = arr->elements->fields[slot];
+            return property_value(*e.get(a, idx, f), el->type);
+        }, "Returns the value of a dynamic array element field, e.g. element(\"m_vec\", 0, \"m_vec.#\")")
 
     py::enum_<entity_types>(py_entity, "etype")
         .value("ENT_DEFAULT", ENT_DEFAULT)
@@ -233,25 +293,24 @@ PYBIND11_PLUGIN(butterpy) {
     py::class_<fs> py_fs(m, "fs");
     py_fs.def_readonly("properties", &fs::properties, "List of fields / props")
         .def_readonly("info", &fs::info, "Pointer to field info", py::return_value_policy::reference)
-        .def_readonly("name", &fs::name, "FS name")
-        .def_readonly("hash", &fs::hash, "FS Hash");
+        .def_readonly("name", &fs::name, "Name relative to the parent")
+        .def_readonly("hash", &fs::hash, "Hash of name")
+        .def("size", &fs::size, "Number of children");
 
-    py_fs.def("__getitem__", [](fs &v, uint32_t i) -> fs& {
-        if ( v.info->dynamic && v.properties.size() == 1 ) {
-            return v.properties[0];
-        }
-
-        if (i >= v.properties.size()) {
+    py_fs.def("__getitem__", [](fs &v, uint32_t i) -> const fs& {
+        if (!v.elements && i >= v.size()) {
             throw pybind11::index_error();
         }
 
-        return v.properties[i];
+        return v.child(i);
     }, py::return_value_policy::reference);
 
     py::class_<flattened_serializer>(m, "flattened_serializer")
         .def("spew", &flattened_serializer::spew, "Dump serializer at given index to console")
         .def("get", &flattened_serializer::get, "Return serialzier at given index", py::return_value_policy::reference);
 
+    m.def("serializer_snapshots", &serializer_cache::snapshots, "Sets the directory built serializers are stored in, empty disables it");
+
     /// ----------------------------------------------------------------
     /// parser.hpp
     /// ----------------------------------------------------------------
@@ -261,7 +320,8 @@ PYBIND11_PLUGIN(butterpy) {
         .def_readonly("buildnumber", &parser::buildnumber, "Server buildnumber")
         .def_readonly("stringtables", &parser::stringtables, "Stringtable dictionary")
         .def_readonly("entity_classes", &parser::classes, "Dictionary of entity classes")
-        .def_readonly("flattened_serializer", &parser::serializers, "Flattened Serializers object")
+        .def_property_readonly("flattened_serializer", [](parser& p) { return p.serializers.get(); },
+            "Flattened Serializers object", py::return_value_policy::reference_internal)
         .def_readonly("particle_manager", &parser::particles, "Particle Manager object")
         .def_readonly("baselines", &parser::baselines, "List of entity baselines, indexed by their class id")
         .def_readonly("entities", &parser::entities, "Global entity list")
@@ -284,7 +344,23 @@ PYBIND11_PLUGIN(butterpy) {
         .def("parse_all", &parser::parse_all, "Parse all packets")
         .def("require", &parser::require, "Enabled forwarding of given packet id")
         .def("seek", &parser::seek, "Seek to the given second in the replay")
-        .def("seek_info", &parser::seek_info, "Returns seeking information", py::return_value_policy::reference);
+        .def("entities_of", [](parser& p, uint32_t cls) {
+            std::vector<entity*> r;
+            for (auto e : p.entities_of(cls))
+                r.push_back(e);
+            return r;
+        }, "Live entities of the given class id", py::return_value_policy::reference)
+        .def("entities_of_type", [](parser& p, entity_types t) {
+            std::vector<entity*> r;
+            for (auto e : p.entities_of_type(t))
+                r.push_back(e);
+            return r;
+        }, "Live entities of the given type", py::return_value_policy::reference)
+        .def("resolve", &parser::resolve, "Resolve an ehandle to the live entity or None", py::return_value_policy::reference)
+        .def("seek_info", &parser::seek_info, "Returns seeking information", py::return_value_policy::reference)
+        .def("shape_info", &parser::shape_info, "Returns entity update shape cache counters")
+        .def("defer_floats", &parser::defer_floats, "Converts fixed width quantized floats only when they are read")
+        .def("resource", [](parser& p, uint64_t hash) { return p.resources.get(hash); }, "Returns the path of a resource hash");
 
     py::enum_<parser::state>(py_parser, "state")
         .value("BEGIN", parser::state::BEGIN)
@@ -296,6 +372,10 @@ PYBIND11_PLUGIN(butterpy) {
         .def_readonly("gamestart", &parser::seekinfo::gamestart, "Time at which the game starts")
         .def_readonly("pregamestart", &parser::seekinfo::pregamestart, "Time at which the horn sounds");
 
+    py::class_<parser::shapeinfo>(py_parser, "shapeinfo")
+        .def_readonly("hits", &parser::shapeinfo::hits, "Updates that reused memoized fieldpaths")
+        .def_readonly("misses", &parser::shapeinfo::misses, "Updates that decoded their fieldpaths");
+
     /// ----------------------------------------------------------------
     /// particle.hpp
     /// ----------------------------------------------------------------
@@ -326,36 +406,6 @@ PYBIND11_PLUGIN(butterpy) {
     /// ----------------------------------------------------------------
 
     py::class_<property> py_property(m, "property");
-    py_property.def_readonly("type", &property::type, "Property type")
-        .def_readonly("info", &property::info, "Pointer to flattened serializer info")
-        .def("value", [](property& p) {
-            switch ( p.type ) {
-            case property::V_BOOL:
-                return py::object( py::bool_(p.data.b) );
-            case property::V_INT32:
-                return py::object( py::int_(p.data.i32) );
-            case property::V_INT64:
-                return py::object( py::int_(p.data.i64) );
-            case property::V_UINT32:
-                return py::object( py::int_(p.data.u32) );
-            case property::V_UINT64:
-                return py::object( py::int_(p.data.u64) );
-            case property::V_FLOAT:
-                return py::object( py::float_(p.data.fl) );
-            case property::V_STRING:
-                return py::object( py::str(p.data_str) );
-            case property::V_VECTOR: {
-                py::list r(3);
-                r[0] = py::float_(p.data.vec[0]);
-                r[1] = py::float_(p.data.vec[1]);
-                r[2] = py::float_(p.data.vec[2]);
-
-                return py::object(r);
-            };
-            default:
-                return py::object( py::str("Unkown") );
-            }
-        }, "Returns the property value");
 
     py::enum_<property::types>(py_property, "ptype")
         .value("V_BOOL", property::V_BOOL)
@@ -366,6 +416,9 @@ PYBIND11_PLUGIN(butterpy) {
         .value("V_FLOAT", property::V_FLOAT)
         .value("V_STRING", property::V_STRING)
         .value("V_VECTOR", property::V_VECTOR)
+        .value("V_ARRAY", property::V_ARRAY)
+        .value("V_QUATERNION", property::V_QUATERNION)
+        .value("V_RESOURCE", property::V_RESOURCE)
         .export_values();
 
     /// ----------------------------------------------------------------
@@ -424,6 +477,7 @@ PYBIND11_PLUGIN(butterpy) {
         .def("end", &bitstream::end, "Returns the size of the stream in bits")
         .def("position", &bitstream::position, "Returns the current position of the stream in bits")
         .def("set_position", &bitstream::setPosition, "Sets bitstream position")
+        .def("check", &bitstream::check, "Raises RuntimeError if the stream has been read past its end")
         .def("seek_forward", &bitstream::seekForward, "Seek n bits forward or until end")
         .def("seek_backward", &bitstream::seekBackward, "Seek n bits back or until the beginning")
         .def("read", &bitstream::read, "Returns result of reading n bits into an uint32_t")
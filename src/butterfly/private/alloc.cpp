@@ -19,12 +19,10 @@
  *    limitations under the License.
  */
 
-#include <butterfly/property.hpp>
 #include <butterfly/entity.hpp>
 
 #include "alloc.hpp"
 
 namespace butterfly {
-    object_pool<property> g_propalloc( 4096 );
     object_pool<entity> g_entalloc( 2048 );
 }
@@ -26,12 +26,8 @@
 
 namespace butterfly {
     // forward decl
-    class property;
     class entity;
 
-    /// Property allocator (global)
-    extern object_pool<property> g_propalloc;
-
     /// Entity allocator (global)
     extern object_pool<entity> g_entalloc;
 } /* butterfly */
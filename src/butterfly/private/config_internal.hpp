@@ -49,4 +49,22 @@
 /// Maximum number of entities
 #define BUTTERFLY_MAX_ENTS 20480
 
+/// Maximum number of elements in a dynamic array
+#define BUTTERFLY_MAX_ARRAY 65536
+
+/// Number of memoized update shapes per entity class
+#define BUTTERFLY_SHAPE_CACHE 4
+
+/// Maximum length of a memoized update shape in bits
+#define BUTTERFLY_SHAPE_BITS 256
+
+/// Maximum number of flag and value bits to decode quantized floats with a lookup table
+#define BUTTERFLY_QUANTIZED_LUT_BITS 12
+
+/// Number of built serializers kept for replays of the same patch
+#define BUTTERFLY_SERIALIZER_CACHE 4
+
+/// Library version, serializer snapshots written by other versions are ignored
+#define BUTTERFLY_VERSION "1.0"
+
 #endif /* BUTTERFLY_CONFIG_INTERNAL_HPP */
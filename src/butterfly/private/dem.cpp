@@ -25,6 +25,7 @@
 #include <butterfly/proto/demo.pb.h>
 #include <butterfly/dem.hpp>
 #include <butterfly/util_assert.hpp>
+#include <butterfly/util_bitstream.hpp>
 
 #include "util_varint.hpp"
 
@@ -35,11 +36,11 @@ namespace butterfly {
         const char* data = msg.data;
         msg.data         = nullptr;
 
-        ASSERT_TRUE( snappy::IsValidCompressedBuffer( data, msg.size ), "Invalid snappy compression buffer" );
-        ASSERT_TRUE(
+        REPLAY_CHECK( snappy::IsValidCompressedBuffer( data, msg.size ), "Invalid snappy compression buffer" );
+        REPLAY_CHECK(
             snappy::GetUncompressedLength( data, msg.size, &size_uncompressed ), "Unable to get uncompressed length" );
-        ASSERT_GREATER( buffer_size, size_uncompressed, "Can't fit uncompressed data into Buffer" );
-        ASSERT_TRUE( snappy::RawUncompress( data, msg.size, buffer ), "Failed to decompress data" );
+        REPLAY_CHECK( size_uncompressed <= buffer_size, "Can't fit uncompressed data into Buffer" );
+        REPLAY_CHECK( snappy::RawUncompress( data, msg.size, buffer ), "Failed to decompress data" );
 
         msg.type = msg.type & ~DEM_IsCompressed;
         msg.data = buffer;
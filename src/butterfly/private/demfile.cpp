@@ -28,6 +28,7 @@
 #include <butterfly/dem.hpp>
 #include <butterfly/demfile.hpp>
 #include <butterfly/util_assert.hpp>
+#include <butterfly/util_bitstream.hpp>
 
 #include "config_internal.hpp"
 
@@ -45,7 +46,7 @@ namespace butterfly {
         dataSize = ftell( fp ) - fstart;
         fseek( fp, 0, SEEK_SET );
 
-        ASSERT_GREATER( dataSize, sizeof( dem_header ), "File to small" );
+        REPLAY_CHECK( dataSize >= sizeof( dem_header ), "File to small" );
 
         // read everything into the buffer
         data = new char[dataSize + 1];
@@ -84,7 +85,7 @@ namespace butterfly {
     }
 
     dem_packet demfile::get() {
-        ASSERT_TRUE( dataPos <= dataSize, "Trying to read from invalid buffer" );
+        REPLAY_CHECK( dataPos <= dataSize, "Trying to read from invalid buffer" );
 
         dem_packet ret;
         dataPos += dem_from_buffer( ret, data + dataPos, dataSize - dataPos, true );
@@ -92,7 +93,7 @@ namespace butterfly {
         if ( ret.type & DEM_IsCompressed ) {
             dem_uncompress( ret, dataSnappy, BUTTERFLY_SNAPPY_BUFFER_SIZE );
 
-            ASSERT_LESS( ret.type, DEM_Max, "Unkown demo packet received" );
+            REPLAY_CHECK( ret.type <= DEM_Max, "Unkown demo packet received" );
         }
 
         if ( pcb ) {
@@ -123,10 +124,10 @@ namespace butterfly {
 
         if ( pkg.type & DEM_IsCompressed ) {
             dem_uncompress( pkg, dataSnappy, BUTTERFLY_SNAPPY_BUFFER_SIZE );
-            ASSERT_LESS( pkg.type, DEM_Max, "Unkown demo packet received" );
+            REPLAY_CHECK( pkg.type <= DEM_Max, "Unkown demo packet received" );
         }
 
-        ASSERT_TRUE( pkg.type == DEM_FileInfo, "Unkown packet at summary offset" );
+        REPLAY_CHECK( pkg.type == DEM_FileInfo, "Unkown packet at summary offset" );
 
         CDemoFileInfo proto;
         proto.ParseFromArray( pkg.data, pkg.size );
@@ -138,7 +139,7 @@ namespace butterfly {
         // load header
         dem_header* head = (dem_header*)data;
 
-        ASSERT_EQUAL( std::string( head->headerid ), std::string( BUTTERFLY_S2_HEADER ), "Invalid header ID" );
+        REPLAY_CHECK( std::string( head->headerid ) == std::string( BUTTERFLY_S2_HEADER ), "Invalid header ID" );
         offset = head->offset_summary;
 
         // increase position
@@ -19,8 +19,11 @@
  *    limitations under the License.
  */
 
+#include <algorithm>
+#include <string>
 #include <vector>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 
 #include <butterfly/entity.hpp>
@@ -29,119 +32,390 @@
 #include <butterfly/util_bitstream.hpp>
 #include <butterfly/util_chash.hpp>
 
-#include "alloc.hpp"
 #include "config_internal.hpp"
+#include "entity_context.hpp"
 #include "fieldpath.hpp"
 #include "fieldpath_huffman.hpp"
 #include "fieldpath_operations.hpp"
-#include "util_mempool.hpp"
 #include "util_ascii_table.hpp"
 
 namespace butterfly {
-    entity::entity() {
-        this->properties.reserve(512);
+    /** Releases string and array memory owned by a block of cells */
+    static void block_free( property* block, const fs_layout* l ) {
+        for ( auto slot : l->strings ) {
+            block[slot].free_string();
+        }
+
+        for ( auto slot : l->arrays ) {
+            auto& a             = block[slot].data.arr;
+            const fs_layout* el = l->fields[slot]->elements;
+            const uint32_t stride = el->fields.size();
+
+            for ( uint32_t i = 0; i < a.capacity; ++i ) {
+                block_free( a.data + i * stride, el );
+            }
+
+            delete[] a.data;
+            a = property::Array{nullptr, 0, 0};
+        }
     }
 
-    entity::~entity() {
-        for ( auto& prop : properties ) {
-            if ( !prop.second )
-                continue;
+    /** Zeroes a block of cells, keeps string and array memory for reuse */
+    static void block_clear( property* block, const fs_layout* l ) {
+        for ( uint32_t i = 0; i < l->fields.size(); ++i ) {
+            switch ( l->fields[i]->type ) {
+            case property::V_STRING:
+                if ( block[i].data.str.data ) {
+                    block[i].data.str.data[0] = '\0';
+                    block[i].data.str.size    = 0;
+                }
+                break;
+            case property::V_ARRAY:
+                block[i].data.arr.size = 0;
+                break;
+            default:
+                block[i] = property();
+                break;
+            }
+        }
+    }
+
+    /** Duplicates string and array memory of a block whose cells have been copied shallow */
+    static void block_copy( property* dst, const property* src, const fs_layout* l ) {
+        for ( auto slot : l->strings ) {
+            dst[slot].data.str = property::String{nullptr, 0, 0};
+            dst[slot].set_string( src[slot].c_str(), src[slot].data.str.size );
+        }
+
+        for ( auto slot : l->arrays ) {
+            const auto& a         = src[slot].data.arr;
+            const fs_layout* el   = l->fields[slot]->elements;
+            const uint32_t stride = el->fields.size();
+
+            dst[slot].data.arr = property::Array{nullptr, a.size, a.size};
+
+            if ( a.size ) {
+                dst[slot].data.arr.data = new property[a.size * stride];
+                memcpy( dst[slot].data.arr.data, a.data, a.size * stride * sizeof( property ) );
 
-            g_propalloc.free( prop.second );
-            prop.second = nullptr;
+                for ( uint32_t i = 0; i < a.size; ++i ) {
+                    block_copy( dst[slot].data.arr.data + i * stride, a.data + i * stride, el );
+                }
+            }
         }
+    }
+
+    /** Sets the number of elements of a dynamic array, new elements are zero */
+    static void array_resize( property& cell, const fs_layout* el, uint32_t n ) {
+        auto& a               = cell.data.arr;
+        const uint32_t stride = el->fields.size();
 
-        properties.clear();
+        if ( n > a.capacity ) {
+            uint32_t cap   = n > a.capacity * 2 ? n : a.capacity * 2;
+            property* data = new property[cap * stride]();
+
+            // moves ownership of nested memory
+            if ( a.data )
+                memcpy( data, a.data, a.capacity * stride * sizeof( property ) );
+
+            delete[] a.data;
+            a.data     = data;
+            a.capacity = cap;
+        }
+
+        for ( uint32_t i = a.size; i < n; ++i ) {
+            block_clear( a.data + i * stride, el );
+        }
+
+        a.size = n;
+    }
+
+    /** Checks whether the stream continues with the fieldpath bits of a shape, consumes them if it does */
+    static bool shape_match( bitstream& b, const parse_shape& s ) {
+        if ( s.len == 0 || s.len >= b.remaining() )
+            return false;
+
+        const uint32_t full = s.len >> 5;
+        const uint32_t rest = s.len & 31;
+        const auto start    = b.position();
+
+        for ( uint32_t i = 0; i < full; ++i ) {
+            if ( b.peek( 32 ) != s.bits[i] ) {
+                b.setPosition( start );
+                return false;
+            }
+
+            b.consume( 32 );
+        }
+
+        if ( rest ) {
+            if ( b.peek( rest ) != s.bits[full] ) {
+                b.setPosition( start );
+                return false;
+            }
+
+            b.consume( rest );
+        }
+
+        return true;
+    }
+
+    /** Copies len fieldpath bits starting at start into a shape, keeps the stream position */
+    static void shape_store( bitstream& b, parse_shape& s, bitstream::size_type start, uint32_t len ) {
+        const auto end = b.position();
+        b.setPosition( start );
+
+        for ( uint32_t i = 0; i < len; i += 32 ) {
+            const uint32_t n = len - i < 32 ? len - i : 32;
+            s.bits[i >> 5]   = b.peek( n );
+            b.consume( n );
+        }
+
+        b.setPosition( end );
+        s.len = len;
+    }
+
+    entity::entity()
+        : baseline( nullptr ), id( 0 ), serial( 0 ), ser( nullptr ), layout( nullptr ), cls_prev( nullptr ),
+          cls_next( nullptr ), type_prev( nullptr ), type_next( nullptr ) {}
+
+    entity::~entity() {
+        free_cells();
     }
 
-    entity::entity(const entity& e) {
+    entity::entity(const entity& e) : properties( e.properties ), present( e.present ), deferred( e.deferred ) {
+        this->baseline = e.baseline;
         this->id = e.id;
+        this->serial = e.serial;
         this->cls = e.cls;
         this->type = e.type;
         this->cls_hash = e.cls_hash;
+        this->ser = e.ser;
+        this->layout = e.layout;
+        this->cls_prev = nullptr;
+        this->cls_next = nullptr;
+        this->type_prev = nullptr;
+        this->type_next = nullptr;
 
-        for (auto &prop : e.properties) {
-            this->properties[prop.first] = g_propalloc.malloc(*prop.second);
+        // cells are copied shallow, duplicate string and array memory
+        if ( layout ) {
+            block_copy( properties.data(), e.properties.data(), layout );
         }
-   }
+    }
+
+    void entity::set_serializer( const fs* serializer, const fs_layout* layout ) {
+        free_cells();
+
+        this->ser    = serializer;
+        this->layout = layout;
+
+        properties.assign( layout->fields.size(), property() );
+        present.assign( ( layout->fields.size() + 63 ) / 64, 0 );
+        deferred.assign( present.size(), 0 );
+    }
+
+    void entity::reset() {
+        std::fill( present.begin(), present.end(), 0 );
+        std::fill( deferred.begin(), deferred.end(), 0 );
 
-    void entity::set_serializer( const fs* serializer ) {
-        this->ser = serializer;
+        // decoders such as qangle only write some components and rely on zeroed cells
+        block_clear( properties.data(), layout );
     }
 
-    void entity::parse( bitstream& b ) {
+    void entity::free_cells() {
+        if ( !layout )
+            return;
+
+        block_free( properties.data(), layout );
+    }
+
+    void entity::parse( bitstream& b, entity_context& ctx ) {
 #if BUTTERFLY_THREADSAFE
         std::lock_guard<std::mutex> lock( mut );
 #endif /* BUTTERFLY_THREADSAFE */
 
-        static fieldpath fp;
-        static std::vector<const fs*> props( 1024 );
+        fieldpath& fp = ctx.fp;
+        auto& targets = ctx.targets;
+        auto& stack   = ctx.stack;
+        auto& nhops   = ctx.nhops;
+        auto& bases   = ctx.bases;
+        auto& shapes  = ctx.shapes_of( cls );
 
-        props.clear();
-        fp.reset();
+        // covers the entity header, reads are unchecked from here on
+        b.check();
 
-        fieldop* op = nullptr;
-        uint32_t id = 0;
+        // Updates of the same class mostly touch the same fields, reuse the targets of a recent identical update
+        for ( uint32_t i = 0; i < BUTTERFLY_SHAPE_CACHE; ++i ) {
+            if ( shape_match( b, shapes[i] ) ) {
+                ++ctx.shape_hits;
 
-        while ( true ) {
-            // Read op
-            id = 0;
-            op = nullptr;
+                for ( ; i > 0; --i ) {
+                    std::swap( shapes[i], shapes[i - 1] );
+                }
 
-            for ( uint32_t i = 0; i < 17 && !op; ++i ) {
-                id = ( id << 1 ) | b.readBool();
-                op = fieldop_lookup( id );
+                parse_values( b, shapes[0].targets, ctx.defer );
+                return;
             }
+        }
 
-            ASSERT_TRUE( op, "Exhausted max operation bits" );
+        ++ctx.shape_misses;
 
-            // Invoke op
+        const auto start = b.position();
+        targets.clear();
+        fp.reset();
+
+        stack[0] = ser;
+        nhops[0] = 0;
+        bases[0] = 0;
+
+        while ( true ) {
+            // Read and invoke op
+            fieldop* op = fieldop_decode( b );
             op->fp( b, fp );
 
+            // corrupt data could keep the loop going forever
+            b.check();
+
             if ( fp.finished )
                 break;
 
-            auto& d = fp.data;
-
-            /* clang-format off */
-            switch (d.size()) {
-                case 1: props.push_back(&(*ser)[d[0]]); break;
-                case 2: props.push_back(&(*ser)[d[0]][d[1]]); break;
-                case 3: props.push_back(&(*ser)[d[0]][d[1]][d[2]]); break;
-                case 4: props.push_back(&(*ser)[d[0]][d[1]][d[2]][d[3]]); break;
-                case 5: props.push_back(&(*ser)[d[0]][d[1]][d[2]][d[3]][d[4]]); break;
-                case 6: props.push_back(&(*ser)[d[0]][d[1]][d[2]][d[3]][d[4]][d[5]]); break;
-                default: ASSERT_TRUE( 0 != 0, "Invalid fieldpath depth");
+            REPLAY_CHECK( fp.size > 0 && fp.size <= 6, "Invalid fieldpath depth" );
+
+            // Most ops only touch the last index, resolve from the shallowest modified depth
+            for ( uint32_t i = fp.changed; i < fp.size; ++i ) {
+                const fs& m = stack[i]->members();
+                stack[i + 1] = &m.child( fp.data[i] );
+
+                // array elements start a block of their own
+                if ( m.elements ) {
+                    nhops[i + 1] = nhops[i] + 1;
+                    bases[i + 1] = 1;
+                } else {
+                    nhops[i + 1] = nhops[i];
+                    bases[i + 1] = bases[i] + m.offset( fp.data[i] ) + 1;
+                }
+            }
+
+            fp.changed = fp.size;
+
+            parse_target t;
+            t.f     = stack[fp.size];
+            t.nhops = nhops[fp.size];
+            t.cell  = bases[fp.size] - 1;
+            t.slot  = t.cell;
+
+            // Remember every dynamic array we pass
+            if ( t.nhops ) {
+                uint32_t h = 0;
+                for ( uint32_t i = 0; i < fp.size; ++i ) {
+                    if ( stack[i]->elements )
+                        t.hops[h++] = parse_target::hop{stack[i], bases[i] - 1, (uint32_t)fp.data[i]};
+                }
+
+                t.slot = t.hops[0].slot;
             }
-            /* clang-format on */
+
+            targets.push_back( t );
+        }
+
+        // Remember the shape in place of the least recently used one
+        const auto len = b.position() - start;
+        if ( len <= BUTTERFLY_SHAPE_BITS ) {
+            for ( uint32_t i = BUTTERFLY_SHAPE_CACHE - 1; i > 0; --i ) {
+                std::swap( shapes[i], shapes[i - 1] );
+            }
+
+            shape_store( b, shapes[0], start, len );
+            shapes[0].targets = targets;
         }
 
-        for ( auto& prop : props ) {
-            const uint64_t fid = prop->hash;
+        parse_values( b, targets, ctx.defer );
+    }
+
+    void entity::parse_values( bitstream& b, const std::vector<parse_target>& targets, bool defer ) {
+        for ( auto& t : targets ) {
+            #if BUTTERFLY_DEVCHECKS
+            ASSERT_TRUE( layout->fields[t.slot] == ( t.nhops ? t.hops[0].f : t.f ), "Property slot outside of class layout" );
+            #endif /* BUTTERFLY_DEVCHECKS */
+
+            // Descend into array elements, the length is usually decoded first
+            property* block = properties.data();
+            for ( uint32_t i = 0; i < t.nhops; ++i ) {
+                auto& h         = t.hops[i];
+                property& cell = block[h.slot];
+
+                if ( h.idx >= cell.data.arr.size ) {
+                    REPLAY_CHECK( h.idx < BUTTERFLY_MAX_ARRAY, "Dynamic array index out of range" );
+                    array_resize( cell, h.f->elements, h.idx + 1 );
+                }
+
+                block = cell.data.arr.data + h.idx * h.f->elements->fields.size();
+            }
+
+            property* p = &block[t.cell];
 
-            auto it = properties.find( fid );
-            if ( it != properties.end() ) {
-                prop->decoder( b, prop->info, it->second );
+            if ( t.f->elements ) {
+                property len;
+                t.f->decoder( b, t.f->info, &len );
 
-                #if BUTTERFLY_DEVCHECKS
-                // Any hash collision means type access might be scewed
-                ASSERT_TRUE( it->second->info == prop, "Hash collision in property set" );
-                #endif /* BUTTERFLY_DEVCHECKS */
+                REPLAY_CHECK( len.data.u64 <= BUTTERFLY_MAX_ARRAY, "Dynamic array length out of range" );
+                array_resize( *p, t.f->elements, len.data.u64 );
+            } else if ( t.f->deferred && !t.nhops ) {
+                // only top-level slots are tracked, array elements are always decoded
+                if ( defer ) {
+                    t.f->deferred( b, t.f->info, p );
+                    deferred[t.slot >> 6] |= 1ull << ( t.slot & 63 );
+                } else {
+                    t.f->decoder( b, t.f->info, p );
+                    deferred[t.slot >> 6] &= ~( 1ull << ( t.slot & 63 ) );
+                }
             } else {
-                property* p = g_propalloc.malloc();
-                p->info     = prop;
-                prop->decoder( b, prop->info, p );
-                this->properties[fid] = p;
+                t.f->decoder( b, t.f->info, p );
+            }
+
+            present[t.slot >> 6] |= 1ull << ( t.slot & 63 );
+        }
+
+        b.check();
+    }
+
+    /** Appends all elements of a dynamic array to the table, element names replace the # with the index */
+    static void spew_array( ascii_table& tbl, const property& cell, const fs* f, const std::string& name, resource_cache* res ) {
+        const fs_layout* el   = f->elements;
+        const uint32_t stride = el->fields.size();
+        const size_t tlen     = el->name( 0 ).size();
+
+        for ( uint32_t i = 0; i < cell.data.arr.size; ++i ) {
+            const property* block = cell.data.arr.data + i * stride;
+            const std::string ename = name + "." + std::to_string( i );
+
+            for ( uint32_t j = 0; j < stride; ++j ) {
+                const fs* e = el->fields[j];
+
+                if ( e->elements ) {
+                    const std::string aname = ename + el->name( j ).substr( tlen );
+                    tbl.append( aname, el->hash( j ), block[j].as_string( e->type, res ) );
+                    spew_array( tbl, block[j], e, aname, res );
+                } else if ( !e->size() ) {
+                    tbl.append( ename + el->name( j ).substr( tlen ), el->hash( j ), block[j].as_string( e->type, res ) );
+                }
             }
         }
     }
 
-    void entity::spew(std::ostream &out) {
+    void entity::spew(std::ostream &out, resource_cache* resources) {
         ascii_table tbl;
         tbl.append( "Key", "Hash", "Value" );
 
-        for ( auto& p : properties ) {
-            tbl.append( p.second->info->name, p.second->info->hash, p.second->as_string() );
+        for ( uint32_t i = 0; i < properties.size(); ++i ) {
+            if ( !is_set( i ) )
+                continue;
+
+            const fs* f = layout->fields[i];
+            tbl.append( layout->name( i ), layout->hash( i ), cell( i )->as_string( f->type, resources ) );
+
+            if ( f->elements )
+                spew_array( tbl, properties[i], f, layout->name( i ), resources );
         }
 
         tbl.print( {1, 1, 1}, out );
@@ -0,0 +1,114 @@
+/**
+ * @file entity_context.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ * @par Description
+ *    Scratch state used while decoding entities
+ */
+
+#ifndef BUTTERFLY_ENTITY_CONTEXT_HPP
+#define BUTTERFLY_ENTITY_CONTEXT_HPP
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include <butterfly/flattened_serializer.hpp>
+
+#include "config_internal.hpp"
+#include "fieldpath.hpp"
+
+namespace butterfly {
+    /** Decode target of a single fieldpath, each dynamic array on the path adds a hop into its elements */
+    struct parse_target {
+        /** Dynamic array, its slot in the enclosing block and element index */
+        struct hop {
+            const fs* f;
+            uint32_t slot;
+            uint32_t idx;
+        };
+
+        /** Decoded field */
+        const fs* f;
+        /** Top-level slot the target belongs to */
+        uint32_t slot;
+        /** Slot of the field in the innermost block, equal to slot without hops */
+        uint32_t cell;
+        /** Number of hops */
+        uint32_t nhops;
+        /** Hops, at most one per fieldpath level below the class as arrays may hold arrays */
+        hop hops[FIELDPATH_MAX_DEPTH - 1];
+    };
+
+    /**
+     * Memoized update shape.
+     *
+     * Stores the raw fieldpath bits of an update together with the targets they resolve to. Fieldop decoding
+     * only depends on the bits read, so an update starting with the same bits has the same targets.
+     */
+    struct parse_shape {
+        /** Length in bits, 0 if unused */
+        uint32_t len;
+        /** Raw fieldpath bits */
+        uint32_t bits[BUTTERFLY_SHAPE_BITS / 32];
+        /** Resolved targets */
+        std::vector<parse_target> targets;
+
+        /** Constructor */
+        parse_shape() : len( 0 ) {}
+    };
+
+    /** Most recently used shapes of a class, front is the most recent */
+    typedef std::array<parse_shape, BUTTERFLY_SHAPE_CACHE> parse_shapes;
+
+    /** Per-parser scratch memory for entity::parse, reused for every entity */
+    struct entity_context {
+        /** Current fieldpath */
+        fieldpath fp;
+        /** Targets collected from the fieldpaths of the current entity */
+        std::vector<parse_target> targets;
+        /** Serializer node at each depth of the current fieldpath, stack[0] is the class itself */
+        const fs* stack[FIELDPATH_MAX_DEPTH + 1];
+        /** Number of dynamic arrays above each depth */
+        uint32_t nhops[FIELDPATH_MAX_DEPTH + 1];
+        /** First slot of the children of the node at each depth, within the innermost block */
+        uint32_t bases[FIELDPATH_MAX_DEPTH + 1];
+        /** Shape cache by class id */
+        std::vector<parse_shapes> shapes;
+        /** Number of updates that reused a memoized shape */
+        uint64_t shape_hits;
+        /** Number of updates that had to decode their fieldpaths */
+        uint64_t shape_misses;
+        /** Whether to store raw bits for fields that can be converted on access */
+        bool defer;
+
+        /** Constructor */
+        entity_context() : shape_hits( 0 ), shape_misses( 0 ), defer( false ) { targets.reserve( 1024 ); }
+
+        /** Returns shape cache of the given class */
+        parse_shapes& shapes_of( uint32_t cls ) {
+            if ( shapes.size() <= cls )
+                shapes.resize( cls + 1 );
+
+            return shapes[cls];
+        }
+    };
+} /* butterfly */
+
+#endif /* BUTTERFLY_ENTITY_CONTEXT_HPP */
@@ -24,36 +24,74 @@
 
 #include <cstdint>
 #include <cstdio>
-#include <vector>
+
+/// Maximum depth of a valid fieldpath
+#define FIELDPATH_MAX_DEPTH 7
 
 namespace butterfly {
     /** Type for a source 2 fieldpath */
     struct fieldpath {
-        fieldpath() : data( {-1} ), finished( false ) { data.reserve( 6 ); }
+        fieldpath() { reset(); }
 
-        /** Fieldpath indicies */
-        std::vector<int32_t> data;
+        /** Fieldpath indicies, padded so a single push op on a valid path stays in bounds */
+        int32_t data[FIELDPATH_MAX_DEPTH + 3];
+        /** Current depth */
+        uint32_t size;
+        /** Shallowest depth modified since the path was last resolved */
+        uint32_t changed;
         /** Marks last path in header */
         bool finished;
 
         /** Reset fieldpath */
         void reset() {
-            data.clear();
-            data.push_back( -1 );
+            data[0]  = -1;
+            size     = 1;
+            changed  = 0;
             finished = false;
         }
 
+        /** Marks depth n as modified */
+        void mark( uint32_t n ) { changed = n < changed ? n : changed; }
+
+        /** Returns the last index for modification */
+        int32_t& back() {
+            mark( size - 1 );
+            return data[size - 1];
+        }
+
+        /** Returns index at given depth for modification */
+        int32_t& at( uint32_t n ) {
+            mark( n );
+            return data[n];
+        }
+
+        /** Appends an index */
+        void push( int32_t idx ) {
+            mark( size );
+            data[size++] = idx;
+        }
+
+        /** Removes the last index */
+        void pop() { --size; }
+
+        /** Truncates the path to n indicies */
+        void resize( uint32_t n ) { size = n; }
+
+        /** Returns index at given depth */
+        int32_t operator[]( uint32_t n ) const { return data[n]; }
+
         /** Dump fieldpath */
         void spew() {
             /* clang-format off */
             auto& d = data;
-            switch ( d.size() ) {
+            switch ( size ) {
                 case 1: printf("%d\n", d[0]); break;
                 case 2: printf("%d/%d\n", d[0], d[1]); break;
                 case 3: printf("%d/%d/%d\n", d[0], d[1], d[2]); break;
                 case 4: printf("%d/%d/%d/%d\n", d[0], d[1], d[2], d[3]); break;
                 case 5: printf("%d/%d/%d/%d/%d\n", d[0], d[1], d[2], d[3], d[4]); break;
                 case 6: printf("%d/%d/%d/%d/%d/%d\n", d[0], d[1], d[2], d[3], d[4], d[5]); break;
+                case 7: printf("%d/%d/%d/%d/%d/%d/%d\n", d[0], d[1], d[2], d[3], d[4], d[5], d[6]); break;
                 default: printf("Invalid Fieldpath\n");
             }
             /* clang-format on */
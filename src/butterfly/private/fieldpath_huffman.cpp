@@ -72,12 +72,53 @@ namespace butterfly {
 	};
     /* clang-format on */
 
-    /** Fieldop Huffman comparison function */
-    template <>
-    int32_t huffman_compare<fieldop>( HuffmanNode* left, HuffmanNode* right ) {
-        if ( left->weight == right->weight )
-            return left->num <= right->num;
+    fieldop_entry fieldop_primary[1 << FIELDOP_PRIMARY_BITS];
+    std::vector<fieldop_table> fieldop_secondary;
 
-        return left->weight > right->weight;
+    /** Fills the decoding tables from the Huffman codes of the fieldop weights */
+    static bool fieldop_build_tables() {
+        std::vector<uint32_t> weights;
+        for ( auto& op : fieldpath_operations ) {
+            weights.push_back( op.weight );
+        }
+
+        const std::vector<huffman_code> codes = huffman_build( weights );
+        std::vector<int32_t> sub( 1 << FIELDOP_PRIMARY_BITS, -1 );
+
+        for ( uint16_t op = 0; op < codes.size(); ++op ) {
+            const uint32_t len = codes[op].len;
+            ASSERT_TRUE( len > 0 && len <= FIELDOP_MAX_BITS, "Fieldop code exceeds table size" );
+
+            // first bit in the stream is the MSB of the code
+            uint32_t rev = 0;
+            for ( uint32_t i = 0; i < len; ++i ) {
+                rev |= ( ( codes[op].code >> ( len - 1 - i ) ) & 1 ) << i;
+            }
+
+            if ( len <= FIELDOP_PRIMARY_BITS ) {
+                for ( uint32_t k = 0; k < ( 1u << ( FIELDOP_PRIMARY_BITS - len ) ); ++k ) {
+                    fieldop_primary[rev | ( k << len )] = fieldop_entry{op, (uint8_t)len};
+                }
+            } else {
+                const uint32_t prefix = rev & masks[FIELDOP_PRIMARY_BITS];
+
+                if ( sub[prefix] < 0 ) {
+                    sub[prefix] = fieldop_secondary.size();
+                    fieldop_secondary.push_back( fieldop_table{} );
+                    fieldop_primary[prefix] = fieldop_entry{(uint16_t)sub[prefix], 0};
+                }
+
+                const uint32_t rem = len - FIELDOP_PRIMARY_BITS;
+                for ( uint32_t k = 0; k < ( 1u << ( FIELDOP_MAX_BITS - len ) ); ++k ) {
+                    fieldop_secondary[sub[prefix]][( rev >> FIELDOP_PRIMARY_BITS ) | ( k << rem )] =
+                        fieldop_entry{op, (uint8_t)len};
+                }
+            }
+        }
+
+        return true;
     }
+
+    /** Tables are built on startup, after fieldpath_operations */
+    static bool fieldop_tables = fieldop_build_tables();
 } /* butterfly */
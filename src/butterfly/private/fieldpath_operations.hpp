@@ -33,227 +33,232 @@
 namespace butterfly {
     /* clang-format off */
     void force_inline fp_PlusOne(bitstream &b, fieldpath &f) {
-        f.data.back() += 1;
+        f.back() += 1;
     }
 
     void force_inline fp_PlusTwo(bitstream &b, fieldpath &f) {
-        f.data.back() += 2;
+        f.back() += 2;
     }
 
     void force_inline fp_PlusThree(bitstream &b, fieldpath &f) {
-        f.data.back() += 3;
+        f.back() += 3;
     }
 
     void force_inline fp_PlusFour(bitstream &b, fieldpath &f) {
-        f.data.back() += 4;
+        f.back() += 4;
     }
 
     void force_inline fp_PlusN(bitstream &b, fieldpath &f) {
-        f.data.back() += b.readFPBitVar() + 5;
+        f.back() += b.readFPBitVar() + 5;
     }
 
     void force_inline fp_PushOneLeftDeltaZeroRightZero(bitstream &b, fieldpath &f) {
-        f.data.push_back(0);
+        f.push(0);
     }
 
     void force_inline fp_PushOneLeftDeltaZeroRightNonZero(bitstream &b, fieldpath &f) {
-        f.data.push_back(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushOneLeftDeltaOneRightZero(bitstream &b, fieldpath &f){
-        f.data.back() += 1;
-        f.data.push_back(0);
+        f.back() += 1;
+        f.push(0);
     }
 
     void force_inline fp_PushOneLeftDeltaOneRightNonZero(bitstream &b, fieldpath &f){
-        f.data.back() += 1;
-        f.data.push_back(b.readFPBitVar());
+        f.back() += 1;
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushOneLeftDeltaNRightZero(bitstream &b, fieldpath &f){
-        f.data.back() += b.readFPBitVar();
-        f.data.push_back(0);
+        f.back() += b.readFPBitVar();
+        f.push(0);
     }
 
     void force_inline fp_PushOneLeftDeltaNRightNonZero(bitstream &b, fieldpath &f) {
-        f.data.back() += b.readFPBitVar() + 2;
-        f.data.push_back(b.readFPBitVar() + 1);
+        f.back() += b.readFPBitVar() + 2;
+        f.push(b.readFPBitVar() + 1);
     }
 
     void force_inline fp_PushOneLeftDeltaNRightNonZeroPack6Bits(bitstream &b, fieldpath &f) {
-        f.data.back() += b.read(3) + 2;
-        f.data.push_back(b.read(3) + 1);
+        f.back() += b.read(3) + 2;
+        f.push(b.read(3) + 1);
     }
 
     void force_inline fp_PushOneLeftDeltaNRightNonZeroPack8Bits(bitstream &b, fieldpath &f) {
-        f.data.back() += b.read(4) + 2;
-        f.data.push_back(b.read(4) + 1);
+        f.back() += b.read(4) + 2;
+        f.push(b.read(4) + 1);
     }
 
     void force_inline fp_PushTwoLeftDeltaZero(bitstream &b, fieldpath &f) {
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushTwoLeftDeltaOne(bitstream &b, fieldpath &f) {
-        f.data.back() += 1;
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
+        f.back() += 1;
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushTwoLeftDeltaN(bitstream &b, fieldpath &f) {
-        f.data.back() += b.readUBitVar() + 2;
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
+        f.back() += b.readUBitVar() + 2;
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushTwoPack5LeftDeltaZero(bitstream &b, fieldpath &f) {
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
+        f.push(b.read(5));
+        f.push(b.read(5));
     }
 
     void force_inline fp_PushTwoPack5LeftDeltaOne(bitstream &b, fieldpath &f) {
-        f.data.back() += 1;
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
+        f.back() += 1;
+        f.push(b.read(5));
+        f.push(b.read(5));
     }
 
     void force_inline fp_PushTwoPack5LeftDeltaN(bitstream &b, fieldpath &f) {
-        f.data.back() += b.readUBitVar() + 2;
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
+        f.back() += b.readUBitVar() + 2;
+        f.push(b.read(5));
+        f.push(b.read(5));
     }
 
     void force_inline fp_PushThreeLeftDeltaZero(bitstream &b, fieldpath &f) {
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushThreeLeftDeltaOne(bitstream &b, fieldpath &f) {
-        f.data.back() += 1;
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
+        f.back() += 1;
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushThreeLeftDeltaN(bitstream &b, fieldpath &f) {
-        f.data.back() += b.readUBitVar() + 2;
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
-        f.data.push_back(b.readFPBitVar());
+        f.back() += b.readUBitVar() + 2;
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
+        f.push(b.readFPBitVar());
     }
 
     void force_inline fp_PushThreePack5LeftDeltaZero(bitstream &b, fieldpath &f) {
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
+        f.push(b.read(5));
+        f.push(b.read(5));
+        f.push(b.read(5));
     }
 
     void force_inline fp_PushThreePack5LeftDeltaOne(bitstream &b, fieldpath &f) {
-        f.data.back() += 1;
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
+        f.back() += 1;
+        f.push(b.read(5));
+        f.push(b.read(5));
+        f.push(b.read(5));
     }
 
     void force_inline fp_PushThreePack5LeftDeltaN(bitstream &b, fieldpath &f) {
-        f.data.back() += b.readUBitVar() + 2;
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
-        f.data.push_back(b.read(5));
+        f.back() += b.readUBitVar() + 2;
+        f.push(b.read(5));
+        f.push(b.read(5));
+        f.push(b.read(5));
     }
 
     void force_inline fp_PushN(bitstream &b, fieldpath &f) {
         uint32_t n = b.readUBitVar();
+        REPLAY_CHECK(n <= FIELDPATH_MAX_DEPTH - f.size, "Invalid fp size for op");
 
         for (uint32_t i = 0; i < n; ++i) {
-            f.data.push_back(b.readFPBitVar());
+            f.push(b.readFPBitVar());
         }
     }
 
     void force_inline fp_PushNAndNonTopological(bitstream &b, fieldpath &f) {
-        for (auto &idx : f.data) {
-            if (b.read(1)) idx += b.readVarSInt32() + 1;
+        for (uint32_t i = 0; i < f.size; ++i) {
+            if (b.read(1)) f.at(i) += b.readVarSInt32() + 1;
         }
 
         uint32_t n = b.readUBitVar();
+        REPLAY_CHECK(n <= FIELDPATH_MAX_DEPTH - f.size, "Invalid fp size for op");
+
         for (uint32_t i = 0; i < n; ++i) {
-            f.data.push_back(b.readFPBitVar());
+            f.push(b.readFPBitVar());
         }
     }
 
     void force_inline fp_PopOnePlusOne(bitstream &b, fieldpath &f) {
-        f.data.pop_back();
-        f.data.back() += 1;
+        REPLAY_CHECK(f.size >= 2, "Invalid fp size for op");
+        f.pop();
+        f.back() += 1;
     }
 
     void force_inline fp_PopOnePlusN(bitstream &b, fieldpath &f) {
-        f.data.pop_back();
-        f.data.back() += b.readFPBitVar() + 1;
+        REPLAY_CHECK(f.size >= 2, "Invalid fp size for op");
+        f.pop();
+        f.back() += b.readFPBitVar() + 1;
     }
 
     void force_inline fp_PopAllButOnePlusOne(bitstream &b, fieldpath &f) {
-        f.data.resize(1);
-        f.data.back() += 1;
+        f.resize(1);
+        f.back() += 1;
     }
 
     void force_inline fp_PopAllButOnePlusN(bitstream &b, fieldpath &f) {
-        f.data.resize(1);
-        f.data.back() += b.readFPBitVar() + 1;
+        f.resize(1);
+        f.back() += b.readFPBitVar() + 1;
     }
 
     void force_inline fp_PopAllButOnePlusNPack3Bits(bitstream &b, fieldpath &f) {
-        f.data.resize(1);
-        f.data.back() += b.read(3) + 1;
+        f.resize(1);
+        f.back() += b.read(3) + 1;
     }
 
     void force_inline fp_PopAllButOnePlusNPack6Bits(bitstream &b, fieldpath &f) {
-        f.data.resize(1);
-        f.data.back() += b.read(6) + 1;
+        f.resize(1);
+        f.back() += b.read(6) + 1;
     }
 
     void force_inline fp_PopNPlusOne(bitstream &b, fieldpath &f) {
-        uint32_t nsize = f.data.size() - b.readFPBitVar();
-        ASSERT_TRUE(nsize < 7 && nsize > 0,  "Invalid fp size for op");
+        uint32_t nsize = f.size - b.readFPBitVar();
+        REPLAY_CHECK(nsize < 7 && nsize > 0,  "Invalid fp size for op");
 
-        f.data.resize(nsize);
-        f.data.back() += 1;
+        f.resize(nsize);
+        f.back() += 1;
     }
 
     void force_inline fp_PopNPlusN(bitstream &b, fieldpath &f) {
-        uint32_t nsize = f.data.size() - b.readFPBitVar();
-        ASSERT_TRUE(nsize < 7 && nsize > 0,  "Invalid fp size for op");
+        uint32_t nsize = f.size - b.readFPBitVar();
+        REPLAY_CHECK(nsize < 7 && nsize > 0,  "Invalid fp size for op");
 
-        f.data.resize(nsize);
-        f.data.back() += b.readVarSInt32();
+        f.resize(nsize);
+        f.back() += b.readVarSInt32();
     }
 
     void force_inline fp_PopNAndNonTopographical(bitstream &b, fieldpath &f) {
-        uint32_t nsize = f.data.size() - b.readFPBitVar();
-        ASSERT_TRUE(nsize < 7 && nsize > 0,  "Invalid fp size for op");
+        uint32_t nsize = f.size - b.readFPBitVar();
+        REPLAY_CHECK(nsize < 7 && nsize > 0,  "Invalid fp size for op");
 
-        f.data.resize(nsize);
+        f.resize(nsize);
 
-        for (auto &idx : f.data) {
-            if (b.read(1)) idx += b.readVarSInt32();
+        for (uint32_t i = 0; i < f.size; ++i) {
+            if (b.read(1)) f.at(i) += b.readVarSInt32();
         }
     }
 
     void force_inline fp_NonTopoComplex(bitstream &b, fieldpath &f) {
-        for (auto &idx : f.data) {
-            if (b.read(1)) idx += b.readVarSInt32();
+        for (uint32_t i = 0; i < f.size; ++i) {
+            if (b.read(1)) f.at(i) += b.readVarSInt32();
         }
     }
 
     void force_inline fp_NonTopoPenultimatePlusOne(bitstream &b, fieldpath &f) {
-        ASSERT_TRUE(f.data.size() >= 2, "Invalid fp size for op");
-        f.data[f.data.size() - 2] += 1;
+        REPLAY_CHECK(f.size >= 2, "Invalid fp size for op");
+        f.at(f.size - 2) += 1;
     }
 
     void force_inline fp_NonTopoComplexPack4Bits(bitstream &b, fieldpath &f) {
-        for (auto &idx : f.data) {
-            if (b.read(1)) idx += b.read(4) - 7;
+        for (uint32_t i = 0; i < f.size; ++i) {
+            if (b.read(1)) f.at(i) += b.read(4) - 7;
         }
     }
 
@@ -19,22 +19,28 @@
  *    limitations under the License.
  */
 
+#include <list>
+#include <mutex>
 #include <string>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 
 #include <butterfly/util_assert.hpp>
 #include <butterfly/entity_classes.hpp>
 #include <butterfly/flattened_serializer.hpp>
+#include <butterfly/property.hpp>
 #include <butterfly/property_decoder.hpp>
 #include <butterfly/util_chash.hpp>
 #include <butterfly/util_ztime.hpp>
 
+#include "config_internal.hpp"
+
 #include "util_ascii_table.hpp"
 
 namespace butterfly {
     flattened_serializer::flattened_serializer( uint8_t* data, uint32_t size ) {
-        ASSERT_TRUE( serializers.ParseFromArray( data, size ), "Unable to parse buffer as FlattenedSerializer packet" );
+        REPLAY_CHECK( serializers.ParseFromArray( data, size ), "Unable to parse buffer as FlattenedSerializer packet" );
     }
 
     flattened_serializer::~flattened_serializer() {
@@ -42,20 +48,186 @@ namespace butterfly {
             delete m.second.info;
         }
 
-        for ( auto& t : tables ) {
-            delete t.info;
+        for ( auto& t : tables_internal ) {
+            delete t.value.info;
+        }
+
+        for ( auto l : element_layouts ) {
+            delete l;
+        }
+
+        for ( auto l : layouts ) {
+            delete l;
         }
     }
 
     /** Return serializer at given index */
-    const fs& flattened_serializer::get( uint32_t idx ) { return tables.at( idx ); }
+    const fs& flattened_serializer::get( uint32_t idx ) const {
+        // classes without a networked serializer have no properties
+        static const fs empty;
+        return tables.at( idx ) ? *tables[idx] : empty;
+    }
+
+    /** Return property layout for serializer at given index */
+    const fs_layout& flattened_serializer::get_layout( uint32_t idx ) const { return *layouts.at( idx ); }
+
+    constexpr uint32_t fs_layout::npos;
+
+    // Name building lock, layouts may be shared between parsers
+    static std::mutex g_namelock;
+
+    uint32_t fs_layout::local_name( uint32_t slot, const char*& str, char* buf ) const {
+        const uint32_t p = parents[slot];
+
+        // elements of fixed size arrays are named after their index
+        if ( p != npos && fields[p]->count ) {
+            str = buf;
+            return snprintf( buf, 16, "%u", ( slot - p - 1 ) / fields[slot]->span );
+        }
+
+        str = fields[slot]->name.data();
+        return fields[slot]->name.size();
+    }
+
+    void fs_layout::build_names() const {
+        if ( named.load( std::memory_order_acquire ) )
+            return;
+
+        std::lock_guard<std::mutex> lock( g_namelock );
+        if ( named.load( std::memory_order_relaxed ) )
+            return;
+
+        names.resize( fields.size() );
+
+        for ( uint32_t i = 0; i < fields.size(); ++i ) {
+            const uint32_t p = parents[i];
+            const char* str;
+            char buf[16];
+            uint32_t len = local_name( i, str, buf );
+
+            if ( p != npos ) {
+                names[i].reserve( names[p].size() + 1 + len );
+                names[i].append( names[p] ).append( 1, '.' ).append( str, len );
+            } else if ( !root.empty() ) {
+                names[i].append( root ).append( 1, '.' ).append( str, len );
+            } else {
+                names[i].assign( str, len );
+            }
+        }
+
+        named.store( true, std::memory_order_release );
+    }
+
+    void fs_layout::build_hashes() const {
+        if ( hashed.load( std::memory_order_acquire ) )
+            return;
+
+        std::lock_guard<std::mutex> lock( g_namelock );
+        if ( hashed.load( std::memory_order_relaxed ) )
+            return;
+
+        hashes.resize( fields.size() );
+        slots.reserve( fields.size() );
+
+        // FNV-1a has no finalization, the hash of a prefix is the state to continue hashing from
+        uint64_t prefix = constexpr_hash_rt( root.data(), root.size() );
+
+        for ( uint32_t i = 0; i < fields.size(); ++i ) {
+            const uint32_t p = parents[i];
+            const char* str;
+            char buf[16];
+            uint32_t len = local_name( i, str, buf );
+
+            uint64_t h = constexpr_hash( "" );
+            if ( p != npos ) {
+                h = constexpr_hash_rt( ".", 1, hashes[p] );
+            } else if ( !root.empty() ) {
+                h = constexpr_hash_rt( ".", 1, prefix );
+            }
+
+            hashes[i]        = constexpr_hash_rt( str, len, h );
+            slots[hashes[i]] = i;
+        }
+
+        hashed.store( true, std::memory_order_release );
+    }
+
+    /** Assigns the relative slots below f, returns the number of slots f occupies */
+    static uint32_t layout_span( fs& f ) {
+        // shared serializers have been laid out when they were built
+        if ( f.table ) {
+            f.span = f.table->span;
+            return f.span;
+        }
+
+        // elements live in a block of their own
+        if ( f.type == property::V_ARRAY ) {
+            layout_span( f.properties[0] );
+            f.span = 1;
+            return f.span;
+        }
+
+        uint32_t n = 1;
+
+        if ( f.count ) {
+            n += f.count * layout_span( f.properties[0] );
+        } else {
+            for ( auto& c : f.properties ) {
+                c.slot = n - 1;
+                n += layout_span( c );
+            }
+        }
+
+        f.span = n;
+        return f.span;
+    }
+
+    /** Appends f and all nodes below it to the layout, the order matches the slots assigned by layout_span */
+    static void layout_append( fs_layout& l, const fs& f, uint32_t parent ) {
+        const uint32_t slot = l.fields.size();
+        l.fields.push_back( &f );
+        l.parents.push_back( parent );
+
+        if ( f.type == property::V_STRING )
+            l.strings.push_back( slot );
+
+        if ( f.elements ) {
+            l.arrays.push_back( slot );
+            return;
+        }
+
+        if ( f.count ) {
+            for ( uint32_t i = 0; i < f.count; ++i ) {
+                layout_append( l, f.properties[0], slot );
+            }
+
+            return;
+        }
+
+        for ( auto& c : f.members().properties ) {
+            layout_append( l, c, slot );
+        }
+    }
+
+    /** Collects all dynamic arrays below f, shared serializers are visited on their own */
+    static void layout_arrays( fs& f, std::vector<fs*>& arrays ) {
+        if ( f.type == property::V_ARRAY )
+            arrays.push_back( &f );
+
+        for ( auto& c : f.properties ) {
+            layout_arrays( c, arrays );
+        }
+    }
 
     /* clang-format off */
     void flattened_serializer::build( entity_classes& cls ) {
         BENCHMARK_START(flattened_serializer);
 
         uint32_t tbl_id = 0;
-        tables.resize( cls.classes.size() );
+        tables.assign( cls.classes.size(), nullptr );
+
+        // nodes refer to earlier serializers by pointer, entries must not move
+        tables_internal.reserve( serializers.serializers_size() );
 
         for ( auto& ser : serializers.serializers() ) {
             // append version to serializer name
@@ -65,6 +237,8 @@ namespace butterfly {
 
             // field we are currently parsing
             fs current;
+            current.name = tblName;
+            current.info = new fs_info{tblName};
 
             // iterate all field indicies
             for ( auto& f : ser.fields_index() ) {
@@ -72,93 +246,257 @@ namespace butterfly {
                 auto info = get_metadata(f);
 
                 if (info.is_table)
-                    field = tables_internal.by_index(info.table).value;
+                    field.table = &tables_internal.by_index(info.table).value;
 
                 field.decoder = info.decoder;
+                field.type = prop_decoder_type(info.decoder);
                 field.info = info.info;
-
-                if (info.size) {
+                field.name = info.info->name;
+                field.hash = constexpr_hash_rt(field.name.c_str());
+                field.deferred = prop_decoder_deferred(info.decoder, info.info, &field.convert);
+
+                if (info.is_dynamic) {
+                    // a single element describes all entries, storage is sized by the decoded length
+                    fs elem = field;
+                    elem.name = "#";
+                    elem.hash = constexpr_hash_rt("#");
+                    elem.decoder = info.element;
+                    elem.deferred = nullptr;
+                    elem.convert = nullptr;
+
+                    // objects without a serializer have always been read as varints
+                    if (!info.element && !info.is_table)
+                        elem.decoder = prop_decode_varint;
+
+                    elem.type = prop_decoder_type(elem.decoder);
+
+                    fs arr;
+                    arr.info = info.info;
+                    arr.name = field.name;
+                    arr.hash = field.hash;
+                    arr.decoder = prop_decode_dynamic;
+                    arr.type = prop_decoder_type(prop_decode_dynamic);
+                    arr.properties.push_back(elem);
+
+                    current.properties.push_back(std::move(arr));
+                } else if (info.size) {
+                    // the element is stored once and named by index
                     fs arr = field;
+                    arr.table = nullptr;
+                    arr.count = info.size;
 
-                    if (info.is_dynamic) {
-                        fs arr2;
-                        arr2.info = info.info;
-                        arr2.decoder = prop_decode_dynamic;
-                        for (uint32_t i = 0; i < info.size; ++i) {
-                            arr2.properties.push_back(arr);
-                            arr2.properties.back().name = std::to_string(i);
-                        }
-
-                        current.properties.push_back(arr2);
-                    } else {
-                        for (uint32_t i = 0; i < info.size; ++i) {
-                            arr.properties.push_back(field);
-                            arr.properties.back().name = std::to_string(i);
-                        }
-
-                        current.properties.push_back(arr);
-                    }
+                    field.name.clear();
+                    field.hash = 0;
+                    arr.properties.push_back(std::move(field));
+
+                    current.properties.push_back(std::move(arr));
                 } else {
-                    current.properties.push_back(field);
+                    current.properties.push_back(std::move(field));
                 }
             }
 
+            layout_span(current);
+
             // append to internal table
-            tables_internal.insert(tbl_id++, tblName, current);
+            const fs* tbl = &tables_internal.insert(tbl_id++, tblName, std::move(current)).value;
 
-            // If the entity is networked, also append it to the public table
+            // If the entity is networked, also reference it in the public table
             if (cls.is_networked(tblName)) {
-                current.info = new fs_info{tblName};
-                tables[cls.class_id(tblName)] = current;
+                tables[cls.class_id(tblName)] = tbl;
             }
         }
 
-        // append name and hash
-        for (fs& f : tables) {
-            for (fs& f2 : f.properties) {
-                app_name_hash(f.name, f2);
-            }
-        }
+        build_layouts();
 
         BENCHMARK_END(flattened_serializer);
     }
 
-    void flattened_serializer::spew( uint32_t idx, std::ostream& out ) {
+    void flattened_serializer::build_layouts() {
+        // every dynamic array needs its element layout before any layout is flattened
+        std::vector<fs*> arrays;
+        for ( auto& t : tables_internal ) {
+            layout_arrays(t.value, arrays);
+        }
+
+        element_layouts.resize( arrays.size() );
+        for ( uint32_t i = 0; i < arrays.size(); ++i ) {
+            element_layouts[i] = new fs_layout;
+            element_layouts[i]->root = arrays[i]->name;
+            arrays[i]->elements = element_layouts[i];
+        }
+
+        for ( uint32_t i = 0; i < arrays.size(); ++i ) {
+            layout_append(*element_layouts[i], arrays[i]->properties[0], fs_layout::npos);
+        }
+
+        // flatten the networked classes, shared nodes show up once per place they are used
+        layouts.resize( tables.size() );
+        for (uint32_t i = 0; i < tables.size(); ++i) {
+            layouts[i] = new fs_layout;
+            if (!tables[i])
+                continue;
+
+            for (auto& f : tables[i]->properties) {
+                layout_append(*layouts[i], f, fs_layout::npos);
+            }
+        }
+    }
+
+    void flattened_serializer::spew( uint32_t idx, std::ostream& out ) const {
         ascii_table tbl;
         tbl.append("Id", "Name", "Type", "Encoder", "Decoder", "Bits", "Flags", "Min", "Max");
         spew_impl(idx, &tbl, "", false);
         tbl.print({1, 1, 1}, out);
     }
 
-    void flattened_serializer::spew_impl( uint32_t idx, void* tbl, std::string target, bool internal ) {
+    void flattened_serializer::spew_impl( uint32_t idx, void* tbl, std::string target, bool internal ) const {
         uint32_t i = 0;
-        auto fs = tables[idx];
+        const fs& t = internal ? tables_internal.by_index(idx).value : get(idx);
 
-        if (internal)
-            fs = tables_internal.by_index(idx).value;
-
-        for (auto &f : fs.properties) {
+        for (auto &f : t.properties) {
             std::string enc = "-";
             if (f.info->encoder != ""_chash) {
-                enc = serializers.symbols(serializers.fields(f.info->field).var_encoder_sym());
+                enc = symbols.at(f.info->field).encoder;
             }
 
             ((ascii_table*)tbl)->append(
                 target+std::to_string(i),
-                f.info->name, serializers.symbols(serializers.fields(f.info->field).var_type_sym()),
+                f.info->name, get_otype(f.info),
                 enc, prop_decoder_name(f), f.info->bits, f.info->flags, f.info->min, f.info->max
             );
 
-            if (metadata[f.info->field].is_table && metadata[f.info->field].table != idx) {
-                spew_impl(metadata[f.info->field].table, tbl, target+std::to_string(i)+"/", true);
+            const fs_typeinfo& meta = metadata.at(f.info->field);
+            if (meta.is_table && meta.table != idx) {
+                spew_impl(meta.table, tbl, target+std::to_string(i)+"/", true);
             }
 
             ++i;
         }
     }
 
-    std::string flattened_serializer::get_otype( fs_info* f ) {
-        return serializers.symbols(serializers.fields(f->field).var_type_sym());
+    std::string flattened_serializer::get_otype( fs_info* f ) const {
+        auto it = symbols.find(f->field);
+        return it != symbols.end() ? it->second.type : "";
+    }
+
+    /** Returns the argument of a template type such as "CHandle< T >", empty if t doesn't use the given template */
+    static std::string type_argument( const std::string& t, const char* tmpl ) {
+        const size_t n = strlen( tmpl );
+        if ( t.size() < n + 2 || t.compare( 0, n, tmpl ) != 0 || t[n] != '<' || t.back() != '>' )
+            return "";
+
+        // spaces inside the brackets are optional
+        size_t first = t.find_first_not_of( ' ', n + 1 );
+        size_t last  = t.find_last_not_of( ' ', t.size() - 2 );
+        return first <= last && last != std::string::npos ? t.substr( first, last - first + 1 ) : "";
+    }
+
+    /** Returns the decoder for a single value of type t, nullptr for objects and types without a known encoding */
+    static decoder_fcn* type_decoder( const std::string& t ) {
+        switch ( constexpr_hash_rt( t.c_str() ) ) {
+        case "bool"_chash:
+            return prop_decode_bool;
+        case "char"_chash:
+        case "CUtlString"_chash:
+        case "CUtlSymbolLarge"_chash:
+            return prop_decode_string;
+        case "float32"_chash:
+            return prop_decode_float;
+        case "CNetworkedQuantizedFloat"_chash:
+            return prop_decode_quantized;
+        case "Vector"_chash:
+            return prop_decode_vector;
+        case "Vector2D"_chash:
+            return prop_decode_vector2d;
+        case "Vector4D"_chash:
+            return prop_decode_vector4d;
+        case "Quaternion"_chash:
+            return prop_decode_quaternion;
+        case "QAngle"_chash:
+            return prop_decode_qangle;
+        case "int8"_chash:
+        case "int16"_chash:
+        case "int32"_chash:
+        case "int64"_chash:
+            return prop_decode_svarint;
+        case "uint8"_chash:
+        case "uint16"_chash:
+        case "uint32"_chash:
+        case "uint64"_chash:
+        case "CEntityHandle"_chash:
+        case "CGameSceneNodeHandle"_chash:
+        case "CUtlStringToken"_chash:
+        case "HSequence"_chash:
+        case "Color"_chash:
+        case "color32"_chash:
+            return prop_decode_varint;
+        }
+
+        if ( !type_argument( t, "CHandle" ).empty() )
+            return prop_decode_varint;
+
+        // models and particles are looked up by path, other resources have always been plain varints
+        std::string resource = type_argument( t, "CStrongHandle" );
+        if ( resource == "InfoForResourceTypeCModel" || resource == "InfoForResourceTypeIParticleSystemDefinition" )
+            return prop_decode_resource;
+
+        if ( !resource.empty() )
+            return prop_decode_varint;
+
+        // entity pointers and components are only sent as being present
+        const std::string component = "Component";
+        if ( t.back() == '*' || ( t.size() > component.size() && t[0] == 'C' &&
+                                    t.compare( t.size() - component.size(), component.size(), component ) == 0 ) )
+            return prop_decode_bool;
+
+        return nullptr;
+    }
+
+    /**
+     * Fills decoder, element decoder and array size from a type signature, e.g. "uint8[32]" or "CUtlVector< CHandle< CBaseEntity > >".
+     *
+     * Types without a known encoding are assumed to be enums and decoded as varints, unless they refer to a
+     * serializer. Returns false for such types. Throws replay_corrupt for array lengths given as constants,
+     * those types need an entry in flattened_serializer.inline.
+     */
+    static bool type_parse( const std::string& type, fs_typeinfo& ret ) {
+        std::string t = type;
+        uint32_t size = 0;
+
+        // fixed size array, the length has to fit fs_typeinfo::size
+        size_t bracket = t.rfind( '[' );
+        if ( bracket != std::string::npos && t.back() == ']' ) {
+            std::string len = t.substr( bracket + 1, t.size() - bracket - 2 );
+            REPLAY_CHECK( !len.empty() && len.size() <= 4 && len.find_first_not_of( "0123456789" ) == std::string::npos,
+                "Unresolved array length in type signature" );
+
+            size = std::stoul( len );
+            t    = t.substr( 0, bracket );
+        }
+
+        // dynamic array, elements of objects are decoded through the serializer
+        for ( const char* tmpl : {"CUtlVector", "CNetworkUtlVectorBase", "CUtlVectorEmbeddedNetworkVar"} ) {
+            std::string element = type_argument( t, tmpl );
+            if ( element.empty() )
+                continue;
+
+            ret.decoder    = prop_decode_dynamic;
+            ret.element    = type_decoder( element );
+            ret.is_dynamic = 1;
+            return size == 0;
+        }
+
+        ret.decoder = type_decoder( t );
+
+        // character arrays are a single string
+        ret.size = t == "char" ? 0 : size;
+
+        if ( !ret.decoder && !ret.is_table ) {
+            ret.decoder = prop_decode_varint;
+            return false;
+        }
+
+        return true;
     }
 
     fs_typeinfo& flattened_serializer::get_metadata( uint32_t field ) {
@@ -182,9 +520,6 @@ namespace butterfly {
         uint64_t h_type  = constexpr_hash_rt(f_type.c_str());
         uint64_t h_encoder  = constexpr_hash_rt(f_encoder.c_str());
 
-        // There are 175 unique type signatures at the moment (28.02.2016).
-        // Instead of relying on regex or something similar, we can switch on most of them.
-
         // Checks if we have a subtable
         if (f.has_field_serializer_name_sym()) {
             ret.is_table = true;
@@ -193,17 +528,22 @@ namespace butterfly {
                 ? serializers.symbols(f.field_serializer_name_sym())
                 : serializers.symbols(f.field_serializer_name_sym()) + std::to_string(f.field_serializer_version());
 
-            ASSERT_TRUE(tables_internal.has_key(tblName), "Unkown serializer requested");
+            REPLAY_CHECK(tables_internal.has_key(tblName), "Unkown serializer requested");
             ret.table = tables_internal.by_key(tblName).index;
         } else {
             ret.is_table = false;
         }
 
+        // Signatures that don't follow from their spelling, everything else is parsed
         switch (h_type) {
             #include "flattened_serializer.inline"
             default: {
-                printf("%s\n", f_type.c_str());
-                ASSERT_TRUE(0 != 0, "Unhandled fs type");
+                bool known = type_parse(f_type, ret);
+
+                #if BUTTERFLY_DEVCHECKS
+                if (!known) printf("Guessed encoding of %s\n", f_type.c_str());
+                #endif /* BUTTERFLY_DEVCHECKS */
+                (void)known;
             } break;
         }
 
@@ -236,30 +576,109 @@ namespace butterfly {
         }
 
         // Fill fs_info
-        ret.info = new fs_info{f_name, field, h_encoder, h_type, f_bc, ret.is_dynamic, f_flags, f_min, f_max};
+        ret.info = new fs_info{f_name, field, h_encoder, h_type, f_bc, ret.is_dynamic, f_flags, f_min, f_max,
+            quantized_float_decoder()};
+
+        // Settle the float encoding now instead of for every decoded value
+        ret.decoder = prop_decoder_specialize( ret.decoder, ret.info );
+        ret.element = prop_decoder_specialize( ret.element, ret.info );
 
+        // Only quantized floats need the quantizer and its lookup table
+        if ( prop_decoder_quantized( ret.decoder ) || prop_decoder_quantized( ret.element ) )
+            ret.info->quantized = quantized_float_decoder( f_bc, f_flags, f_min, f_max );
+
+        symbols[field] = field_symbols{f_type, f_encoder};
         metadata[field] = ret;
         return metadata[field];
     }
 
-    void flattened_serializer::app_name_hash(std::string n, fs& f) {
-        if (n.size() > 0) {
-            if (f.name.size() == 0) {
-                f.name = n.append(".").append(f.info->name);
-            } else {
-                f.name = n.append(".").append(f.name);
-            }
-        } else {
-            if (f.name.size() == 0) {
-                f.name = f.info->name;
+    /* clang-format on */
+
+    /** Cached serializers, front is the most recently used */
+    static std::list<std::pair<uint64_t, std::shared_ptr<const flattened_serializer>>> g_serializers;
+
+    /** Snapshot directory, empty if disabled */
+    static std::string g_snapshots;
+
+    // Serializer cache lock, concurrent parsers share the cache regardless of BUTTERFLY_THREADSAFE
+    static std::mutex g_serializerlock;
+
+    /** Inserts s at the front and evicts the least recently used entries, the cache has to be locked */
+    static void serializer_insert( uint64_t key, std::shared_ptr<const flattened_serializer> s ) {
+        // another parser may have built the same serializers in the meantime
+        g_serializers.remove_if( [key]( const std::pair<uint64_t, std::shared_ptr<const flattened_serializer>>& e ) {
+            return e.first == key;
+        } );
+
+        g_serializers.emplace_front( key, std::move( s ) );
+
+        while ( g_serializers.size() > BUTTERFLY_SERIALIZER_CACHE ) {
+            g_serializers.pop_back();
+        }
+    }
+
+    /** Returns the snapshot path for the given key */
+    static std::string serializer_snapshot( const std::string& dir, uint64_t key ) {
+        char file[32];
+        snprintf( file, sizeof( file ), "/%016llx.bfs", static_cast<unsigned long long>( key ) );
+        return dir + file;
+    }
+
+    std::shared_ptr<const flattened_serializer> serializer_cache::get( uint64_t key ) {
+        std::string dir;
+
+        {
+            std::lock_guard<std::mutex> lock( g_serializerlock );
+
+            for ( auto it = g_serializers.begin(); it != g_serializers.end(); ++it ) {
+                if ( it->first == key ) {
+                    g_serializers.splice( g_serializers.begin(), g_serializers, it );
+                    return it->second;
+                }
             }
+
+            dir = g_snapshots;
         }
 
-        f.hash = constexpr_hash_rt(f.name.c_str());
+        if ( dir.empty() )
+            return nullptr;
 
-        for (fs& f2 : f.properties) {
-            app_name_hash(f.name, f2);
+        // other parsers can keep using the cache while the snapshot loads
+        std::shared_ptr<const flattened_serializer> s = flattened_serializer::load( serializer_snapshot( dir, key ).c_str(), key );
+
+        if ( s ) {
+            std::lock_guard<std::mutex> lock( g_serializerlock );
+            serializer_insert( key, s );
         }
+
+        return s;
+    }
+
+    void serializer_cache::put( uint64_t key, std::shared_ptr<const flattened_serializer> s ) {
+        std::string dir;
+
+        {
+            std::lock_guard<std::mutex> lock( g_serializerlock );
+            serializer_insert( key, s );
+            dir = g_snapshots;
+        }
+
+        if ( !dir.empty() )
+            s->save( serializer_snapshot( dir, key ).c_str(), key );
+    }
+
+    void serializer_cache::snapshots( const std::string& dir ) {
+        std::lock_guard<std::mutex> lock( g_serializerlock );
+        g_snapshots = dir;
+    }
+
+    std::size_t serializer_cache::size() {
+        std::lock_guard<std::mutex> lock( g_serializerlock );
+        return g_serializers.size();
+    }
+
+    void serializer_cache::clear() {
+        std::lock_guard<std::mutex> lock( g_serializerlock );
+        g_serializers.clear();
     }
-    /* clang-format on */
 } /* butterfly */
@@ -0,0 +1,418 @@
+/**
+ * @file flattened_serializer_snapshot.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif /* _WIN32 */
+
+#include <butterfly/flattened_serializer.hpp>
+#include <butterfly/property_decoder.hpp>
+#include <butterfly/util_chash.hpp>
+#include <butterfly/util_ztime.hpp>
+
+#include "config_internal.hpp"
+
+namespace butterfly {
+    /** Identifies snapshot files, "BFSS" */
+    static constexpr uint32_t snapshot_magic = 0x53534642;
+
+    /**
+     * Format version, bump whenever fs or fs_info change or type_parse and get_metadata derive different
+     * metadata for the same fields. Decoder ids and the library version are checked by snapshot_build.
+     */
+    static constexpr uint32_t snapshot_version = 2;
+
+    /** Identifies the library build a snapshot was written by, the decoder ids depend on it */
+    static uint64_t snapshot_build() {
+        return constexpr_hash_rt( BUTTERFLY_VERSION, sizeof( BUTTERFLY_VERSION ) - 1, prop_decoder_table_hash() );
+    }
+
+    /** Numbers the temporary files of this process, parsers in several threads may save the same snapshot */
+    static std::atomic<uint32_t> g_snapshot_tmp{0};
+
+    /** Marks missing tables and field information */
+    static constexpr uint32_t snapshot_none = 0xFFFFFFFF;
+
+    /** Appends values in host byte order, snapshots are not meant to be moved between machines */
+    struct snapshot_writer {
+        std::string buf;
+
+        template <typename T>
+        void put( T v ) {
+            buf.append( reinterpret_cast<const char*>( &v ), sizeof( T ) );
+        }
+
+        void put( const std::string& s ) {
+            put<uint32_t>( s.size() );
+            buf.append( s );
+        }
+    };
+
+    /** Reads values written by snapshot_writer, ok turns false once the data runs out */
+    struct snapshot_reader {
+        const char* pos;
+        const char* end;
+        bool ok;
+
+        template <typename T>
+        T get() {
+            T v{};
+            if ( static_cast<size_t>( end - pos ) < sizeof( T ) ) {
+                ok = false;
+                return v;
+            }
+
+            memcpy( &v, pos, sizeof( T ) );
+            pos += sizeof( T );
+            return v;
+        }
+
+        std::string str() {
+            uint32_t n = get<uint32_t>();
+            if ( static_cast<size_t>( end - pos ) < n ) {
+                ok = false;
+                return std::string();
+            }
+
+            pos += n;
+            return std::string( pos - n, n );
+        }
+    };
+
+    /** Read-only view of a snapshot file, mapped where possible */
+    struct snapshot_file {
+        const char* data = nullptr;
+        size_t size      = 0;
+#ifdef _WIN32
+        std::string buf;
+#endif /* _WIN32 */
+
+        snapshot_file( const char* path ) {
+#ifndef _WIN32
+            int fd = open( path, O_RDONLY );
+            if ( fd < 0 )
+                return;
+
+            struct stat st;
+            if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+                void* m = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+                if ( m != MAP_FAILED ) {
+                    data = static_cast<const char*>( m );
+                    size = st.st_size;
+                }
+            }
+
+            close( fd );
+#else
+            FILE* fp = fopen( path, "rb" );
+            if ( !fp )
+                return;
+
+            char chunk[4096];
+            size_t n;
+            while ( ( n = fread( chunk, 1, sizeof( chunk ), fp ) ) > 0 ) {
+                buf.append( chunk, n );
+            }
+
+            fclose( fp );
+            data = buf.data();
+            size = buf.size();
+#endif /* _WIN32 */
+        }
+
+        ~snapshot_file() {
+#ifndef _WIN32
+            if ( data )
+                munmap( const_cast<char*>( data ), size );
+#endif /* _WIN32 */
+        }
+    };
+
+    /**
+     * Writes f and all nodes below it, shared serializers are written as their table index.
+     *
+     * Serializer roots own their field information, it only holds the name and is created again on load.
+     */
+    static void snapshot_node(
+        snapshot_writer& w, const fs& f, const std::unordered_map<const fs*, uint32_t>& tables, bool root ) {
+        w.put<uint32_t>( prop_decoder_id( f.decoder ) );
+        w.put<uint32_t>( f.info && !root ? f.info->field : snapshot_none );
+        w.put<uint32_t>( f.table ? tables.at( f.table ) : snapshot_none );
+        w.put<uint8_t>( f.deferred != nullptr );
+        w.put<uint8_t>( f.type );
+        w.put<uint64_t>( f.hash );
+        w.put<uint32_t>( f.slot );
+        w.put<uint32_t>( f.span );
+        w.put<uint32_t>( f.count );
+        w.put( f.name );
+
+        w.put<uint32_t>( f.properties.size() );
+        for ( auto& c : f.properties ) {
+            snapshot_node( w, c, tables, false );
+        }
+    }
+
+    /** Reads a node written by snapshot_node, the decoders are specialised again for the field information */
+    static bool snapshot_node( snapshot_reader& r, fs& f, const std::unordered_map<uint32_t, fs_info*>& infos,
+        const std::vector<const fs*>& tables ) {
+        bool valid;
+        uint32_t decoder = r.get<uint32_t>();
+        uint32_t info    = r.get<uint32_t>();
+        uint32_t table   = r.get<uint32_t>();
+        bool deferred    = r.get<uint8_t>() != 0;
+
+        f.type  = r.get<uint8_t>();
+        f.hash  = r.get<uint64_t>();
+        f.slot  = r.get<uint32_t>();
+        f.span  = r.get<uint32_t>();
+        f.count = r.get<uint32_t>();
+        f.name  = r.str();
+
+        if ( !r.ok || ( info != snapshot_none && !infos.count( info ) ) ||
+             ( table != snapshot_none && table >= tables.size() ) )
+            return false;
+
+        f.info    = info != snapshot_none ? infos.at( info ) : nullptr;
+        f.table   = table != snapshot_none ? tables[table] : nullptr;
+        f.decoder = prop_decoder_by_id( decoder, valid );
+
+        if ( !valid || ( f.decoder && !f.info ) )
+            return false;
+
+        if ( f.decoder )
+            f.decoder = prop_decoder_specialize( f.decoder, f.info );
+
+        if ( deferred ) {
+            if ( !f.decoder )
+                return false;
+
+            f.deferred = prop_decoder_deferred( f.decoder, f.info, &f.convert );
+            if ( !f.deferred )
+                return false;
+        }
+
+        uint32_t n = r.get<uint32_t>();
+        if ( !r.ok || n > static_cast<size_t>( r.end - r.pos ) )
+            return false;
+
+        f.properties.resize( n );
+        for ( auto& c : f.properties ) {
+            if ( !snapshot_node( r, c, infos, tables ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    void flattened_serializer::save( const char* path, uint64_t key ) const {
+        snapshot_writer w;
+        w.put<uint32_t>( snapshot_magic );
+        w.put<uint32_t>( snapshot_version );
+        w.put<uint64_t>( snapshot_build() );
+        w.put<uint64_t>( key );
+
+        // field information, sorted to write the same file for the same serializers
+        std::vector<uint32_t> fields;
+        for ( auto& m : metadata ) {
+            fields.push_back( m.first );
+        }
+
+        std::sort( fields.begin(), fields.end() );
+        w.put<uint32_t>( fields.size() );
+
+        for ( uint32_t field : fields ) {
+            const fs_typeinfo& t = metadata.at( field );
+            const fs_info& i     = *t.info;
+            const auto& sym      = symbols.at( field );
+
+            w.put<uint32_t>( field );
+            w.put<uint8_t>( t.is_table );
+            w.put<uint16_t>( t.table );
+            w.put<uint8_t>( t.is_dynamic );
+            w.put<uint16_t>( t.size );
+            w.put<uint32_t>( prop_decoder_id( t.decoder ) );
+            w.put<uint32_t>( prop_decoder_id( t.element ) );
+
+            w.put( i.name );
+            w.put<uint64_t>( i.encoder );
+            w.put<uint64_t>( i.type );
+            w.put<uint32_t>( i.bits );
+            w.put<uint8_t>( i.dynamic );
+            w.put<uint32_t>( i.flags );
+            w.put<float>( i.min );
+            w.put<float>( i.max );
+
+            w.put( sym.type );
+            w.put( sym.encoder );
+        }
+
+        // serializers in build order, nodes only refer to earlier ones
+        std::unordered_map<const fs*, uint32_t> index;
+        w.put<uint32_t>( tables_internal.size() );
+
+        for ( uint32_t i = 0; i < tables_internal.size(); ++i ) {
+            const fs& t = tables_internal.by_index( i ).value;
+            index[&t]   = i;
+
+            w.put( tables_internal.by_index( i ).key );
+            snapshot_node( w, t, index, true );
+        }
+
+        // networked classes
+        w.put<uint32_t>( tables.size() );
+        for ( auto t : tables ) {
+            w.put<uint32_t>( t ? index.at( t ) : snapshot_none );
+        }
+
+        // write to a temporary file first, other processes may be loading or writing the snapshot
+#ifndef _WIN32
+        std::string tmp = std::string( path ) + ".tmp" + std::to_string( getpid() );
+#else
+        std::string tmp = std::string( path ) + ".tmp" + std::to_string( _getpid() );
+#endif /* _WIN32 */
+        tmp += "." + std::to_string( g_snapshot_tmp++ );
+        FILE* fp        = fopen( tmp.c_str(), "wb" );
+        if ( !fp )
+            return;
+
+        bool written = fwrite( w.buf.data(), 1, w.buf.size(), fp ) == w.buf.size();
+        written      = fclose( fp ) == 0 && written;
+
+        if ( !written || rename( tmp.c_str(), path ) != 0 )
+            remove( tmp.c_str() );
+    }
+
+    std::shared_ptr<flattened_serializer> flattened_serializer::load( const char* path, uint64_t key ) {
+        BENCHMARK_START( serializer_snapshot );
+
+        snapshot_file file( path );
+        if ( !file.data )
+            return nullptr;
+
+        snapshot_reader r{file.data, file.data + file.size, true};
+        if ( r.get<uint32_t>() != snapshot_magic || r.get<uint32_t>() != snapshot_version ||
+             r.get<uint64_t>() != snapshot_build() || r.get<uint64_t>() != key )
+            return nullptr;
+
+        std::shared_ptr<flattened_serializer> ret( new flattened_serializer );
+
+        // field information
+        std::unordered_map<uint32_t, fs_info*> infos;
+        uint32_t nfields = r.get<uint32_t>();
+
+        for ( uint32_t n = 0; n < nfields && r.ok; ++n ) {
+            uint32_t field = r.get<uint32_t>();
+
+            fs_typeinfo t{0, 0, 0, 0, 0};
+            bool valid_decoder, valid_element;
+            t.is_table   = r.get<uint8_t>() != 0;
+            t.table      = r.get<uint16_t>();
+            t.is_dynamic = r.get<uint8_t>() != 0;
+            t.size       = r.get<uint16_t>();
+            t.decoder    = prop_decoder_by_id( r.get<uint32_t>(), valid_decoder );
+            t.element    = prop_decoder_by_id( r.get<uint32_t>(), valid_element );
+
+            std::string name = r.str();
+            uint64_t encoder = r.get<uint64_t>();
+            uint64_t type    = r.get<uint64_t>();
+            uint32_t bits    = r.get<uint32_t>();
+            bool dynamic     = r.get<uint8_t>() != 0;
+            uint32_t flags   = r.get<uint32_t>();
+            float min        = r.get<float>();
+            float max        = r.get<float>();
+
+            field_symbols sym;
+            sym.type    = r.str();
+            sym.encoder = r.str();
+
+            if ( !r.ok || !valid_decoder || !valid_element || ret->metadata.count( field ) )
+                return nullptr;
+
+            t.info    = new fs_info{name, field, encoder, type, bits, dynamic, flags, min, max, quantized_float_decoder()};
+            t.decoder = prop_decoder_specialize( t.decoder, t.info );
+            t.element = prop_decoder_specialize( t.element, t.info );
+
+            // the quantizer and its lookup table are rebuilt from the stored parameters
+            if ( prop_decoder_quantized( t.decoder ) || prop_decoder_quantized( t.element ) )
+                t.info->quantized = quantized_float_decoder( bits, flags, min, max );
+
+            ret->metadata[field] = t;
+            ret->symbols[field]  = sym;
+            infos[field]         = t.info;
+        }
+
+        // serializers, entries must not move once nodes point to them
+        std::vector<const fs*> internal;
+        uint32_t ntables = r.get<uint32_t>();
+
+        if ( !r.ok || ntables > file.size )
+            return nullptr;
+
+        ret->tables_internal.reserve( ntables );
+
+        for ( uint32_t i = 0; i < ntables; ++i ) {
+            std::string tblName = r.str();
+
+            fs current;
+            if ( !snapshot_node( r, current, infos, internal ) )
+                return nullptr;
+
+            current.info = new fs_info{tblName};
+            internal.push_back( &ret->tables_internal.insert( i, tblName, std::move( current ) ).value );
+        }
+
+        // networked classes
+        uint32_t nclasses = r.get<uint32_t>();
+        if ( !r.ok || nclasses > file.size )
+            return nullptr;
+
+        ret->tables.assign( nclasses, nullptr );
+        for ( auto& t : ret->tables ) {
+            uint32_t idx = r.get<uint32_t>();
+            if ( idx != snapshot_none && idx >= internal.size() )
+                return nullptr;
+
+            t = idx != snapshot_none ? internal[idx] : nullptr;
+        }
+
+        if ( !r.ok || r.pos != r.end )
+            return nullptr;
+
+        ret->build_layouts();
+
+        BENCHMARK_END( serializer_snapshot );
+        return ret;
+    }
+} /* butterfly */
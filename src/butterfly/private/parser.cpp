@@ -19,6 +19,9 @@
  *    limitations under the License.
  */
 
+#include <algorithm>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -43,6 +46,7 @@
 #include <butterfly/visitor.hpp>
 
 #include "alloc.hpp"
+#include "entity_context.hpp"
 #include "util_mempool.hpp"
 #include "util_varint.hpp"
 
@@ -53,8 +57,10 @@
 
 namespace butterfly {
     parser::parser( )
-        : dem( nullptr ), buildnumber( 0 ), serializers( nullptr ), packets( 2048, false ), seekPos( 0 ) {
+        : dem( nullptr ), buildnumber( 0 ), packets( 2048, false ), seekPos( 0 ), ctx( new entity_context ),
+          sendtables_hash( 0 ) {
         entities.resize( BUTTERFLY_MAX_ENTS, nullptr );
+        std::fill( std::begin( type_live ), std::end( type_live ), nullptr );
     }
 
     parser::~parser() {
@@ -75,8 +81,13 @@ namespace butterfly {
             }
         }
 
-        if ( serializers )
-            delete serializers;
+        for ( auto& l : recycled ) {
+            for ( auto e : l ) {
+                g_entalloc.free( e );
+            }
+        }
+
+        delete ctx;
     }
 
     void parser::open( const char* path, visitor* v ) {
@@ -107,7 +118,7 @@ namespace butterfly {
 
         for ( auto& e : entities ) {
             if ( e ) {
-                g_entalloc.free( e );
+                release( e );
                 e = nullptr;
             }
         }
@@ -139,7 +150,7 @@ namespace butterfly {
             this->dem_handle_file_header( p );
             break;
         case DEM_SendTables:
-            if ( !serializers )
+            if ( !serializers && sendtables.empty() )
                 this->dem_handle_send_tables( p );
             break;
         case DEM_ClassInfo:
@@ -151,7 +162,7 @@ namespace butterfly {
             break;
         case DEM_Packet: {
             CDemoPacket proto;
-            ASSERT_TRUE( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
+            REPLAY_CHECK( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
 
             // Can only be parsed as a bitstream
             bitstream bs( proto.data() );
@@ -159,7 +170,7 @@ namespace butterfly {
         } break;
         case DEM_SignonPacket: {
             CDemoPacket proto;
-            ASSERT_TRUE( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
+            REPLAY_CHECK( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
 
             // Can only be parsed as a bitstream
             bitstream bs( proto.data() );
@@ -190,6 +201,10 @@ namespace butterfly {
         packets[id] = true;
     }
 
+    parser::shapeinfo parser::shape_info() const { return shapeinfo{ctx->shape_hits, ctx->shape_misses}; }
+
+    void parser::defer_floats( bool enable ) { ctx->defer = enable; }
+
     void parser::seek( uint32_t time ) {
         ASSERT_TRUE( seekPos != 0, "Seeking is only available after on_state(SENDTABLES) has been dispatched" );
 
@@ -223,7 +238,7 @@ namespace butterfly {
 
                     switch ( type ) {
                     case svc_CreateStringTable:
-                        ASSERT_GREATER( 1000, size, "Message doesn't fit data buffer" );
+                        REPLAY_CHECK( size <= 1000, "Message doesn't fit data buffer" );
                         bs.readBytes( data, size );
                         this->svc_handle_stringtable_create( data, size );
                         break;
@@ -237,7 +252,7 @@ namespace butterfly {
 
                 // apply stringtables
                 for ( auto& tbl : proto.string_table().tables() ) {
-                    ASSERT_TRUE( stringtables.has_key( tbl.table_name() ), "Unable to find stringtable require for full_packet" );
+                    REPLAY_CHECK( stringtables.has_key( tbl.table_name() ), "Unable to find stringtable require for full_packet" );
 
                     auto& stbl = stringtables.by_key( tbl.table_name() );
                     stbl->update( tbl );
@@ -256,18 +271,16 @@ namespace butterfly {
             while ( e == nullptr && dem->good() ) {
                 // try to find gamerules proxy
                 auto ecls = classes.classes.by_key( "CDOTAGamerulesProxy" ).index;
-                for ( uint32_t i = 0; i < entities.size(); ++i ) {
-                    if ( entities[i] && entities[i]->cls == ecls ) {
-                        e = entities[i];
-                        break;
-                    }
+                for ( auto ent : entities_of( ecls ) ) {
+                    e = ent;
+                    break;
                 }
 
                 // parse one to advance state
                 parse( nullptr );
             }
 
-            ASSERT_TRUE( e, "Unable to find GamerulesProxy entity" );
+            REPLAY_CHECK( e, "Unable to find GamerulesProxy entity" );
 
             // check if we can get to the seekpoint
             trigger = false;
@@ -288,7 +301,7 @@ namespace butterfly {
 
     void parser::dem_handle_file_header( dem_packet& p ) {
         CDemoFileHeader proto;
-        ASSERT_TRUE( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
+        REPLAY_CHECK( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
 
 /**
  * The buildversion is not available in gameservers hosted on OS X machines
@@ -316,7 +329,7 @@ namespace butterfly {
             printf("Error determining build number, using maximum.\n");
         }
 
-        ASSERT_TRUE( this->buildnumber >= 1027, "Unsupported replay format" );
+        REPLAY_CHECK( this->buildnumber >= 1027, "Unsupported replay format" );
 #else  /* EMSCRIPTEN */
         this->buildnumber = 99999;
 #endif /* EMSCRIPTEN */
@@ -324,19 +337,20 @@ namespace butterfly {
 
     void parser::dem_handle_send_tables( dem_packet& p ) {
         CDemoSendTables proto;
-        ASSERT_TRUE( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
+        REPLAY_CHECK( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
 
         // Packet contents: Size as varint, Serialized Flattables buffer
         const std::string& buf = proto.data();
-        ASSERT_GREATER( buf.size(), 10, "Sendtables packet corrupt" );
+        REPLAY_CHECK( buf.size() >= 10, "Sendtables packet corrupt" );
 
         // Read size and verify that we have enough bytes remaining
         uint32_t size, psize;
         uint8_t* data = read_varint32_fast( (uint8_t*)buf.c_str(), size );
         psize         = data - (uint8_t*)buf.c_str();
 
-        ASSERT_GREATER( buf.size() - psize, size, "Sendtables packet corrupt" );
-        this->serializers = new flattened_serializer( data, size );
+        REPLAY_CHECK( buf.size() - psize >= size, "Sendtables packet corrupt" );
+        this->sendtables.assign( (char*)data, size );
+        this->sendtables_hash = constexpr_hash_rt( sendtables.data(), sendtables.size() );
     }
 
     void parser::dem_handle_packet( bitstream& bs, visitor* v ) {
@@ -345,8 +359,9 @@ namespace butterfly {
             alignas( 8 ) char data[70000];
             uint32_t type = bs.readUBitVar();
             uint32_t size = bs.readVarUInt32();
+            bs.check();
 
-            ASSERT_GREATER( 70000, size, "Message doesn't fit data buffer" );
+            REPLAY_CHECK( size <= 70000, "Message doesn't fit data buffer" );
 
             switch ( type ) {
             case svc_CreateStringTable:
@@ -382,7 +397,7 @@ namespace butterfly {
                 particles.process_update( data, size );
             } break;
             default:
-                ASSERT_TRUE( type < packets.size(), "Unkown type would overflow packet list" );
+                REPLAY_CHECK( type < packets.size(), "Unkown type would overflow packet list" );
                 if ( v && packets[type] ) {
                     bs.readBytes( data, size );
                     v->on_packet( type, data, size );
@@ -396,13 +411,13 @@ namespace butterfly {
 
     void parser::dem_handle_class_info( dem_packet& p ) {
         CDemoClassInfo proto;
-        ASSERT_TRUE( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
+        REPLAY_CHECK( proto.ParseFromArray( p.data, p.size ), "Unable to parse protobuf packet" );
 
         BENCHMARK_START( map_classes );
 
         // Map all class_ids to their network_name
         for ( auto& c : proto.classes() ) {
-            ASSERT_TRUE( (unsigned)c.class_id() == classes.classes.size(), "Invalid id skip" );
+            REPLAY_CHECK( (unsigned)c.class_id() == classes.classes.size(), "Invalid id skip" );
 
             classes->insert( c.class_id(), c.network_name(),
                 entity_classes::class_info{constexpr_hash_rt( c.network_name().c_str() ), 0} );
@@ -426,13 +441,41 @@ namespace butterfly {
 
         BENCHMARK_END( map_classes );
 
-        // Build serializers
-        serializers->build( classes );
+        // Recycled entities reference the previous class layout
+        for ( auto& l : recycled ) {
+            for ( auto e : l ) {
+                g_entalloc.free( e );
+            }
+
+            l.clear();
+        }
+
+        // Replays of the same patch share their serializers, only build them if no other parser did
+        REPLAY_CHECK( !sendtables.empty(), "Class info received before sendtables" );
+
+        uint64_t key = constexpr_hash_rt( p.data, p.size, sendtables_hash );
+        serializers  = serializer_cache::get( key );
+
+        if ( !serializers ) {
+            BENCHMARK_START( build_serializers );
+
+            auto s = std::make_shared<flattened_serializer>( (uint8_t*)&sendtables[0], sendtables.size() );
+            s->build( classes );
+            serializers = s;
+            serializer_cache::put( key, s );
+
+            BENCHMARK_END( build_serializers );
+        }
+
+        std::string().swap( sendtables );
+
+        // memoized shapes point into the previous serializers
+        ctx->shapes.clear();
     }
 
     void parser::svc_handle_stringtable_create( const char* data, uint32_t size ) {
         CSVCMsg_CreateStringTable proto;
-        ASSERT_TRUE( proto.ParseFromArray( data, size ), "Unable to parse protobuf packet" );
+        REPLAY_CHECK( proto.ParseFromArray( data, size ), "Unable to parse protobuf packet" );
 
         // Ignore duplicate stringtables when seeking, as we handle creation out-of-bounds
         if (!stringtables.has_key(proto.name())) {
@@ -442,16 +485,81 @@ namespace butterfly {
 
     void parser::svc_handle_stringtable_update( const char* data, uint32_t size ) {
         CSVCMsg_UpdateStringTable proto;
-        ASSERT_TRUE( proto.ParseFromArray( data, size ), "Unable to parse protobuf packet" );
+        REPLAY_CHECK( proto.ParseFromArray( data, size ), "Unable to parse protobuf packet" );
 
-        ASSERT_TRUE( stringtables.has_index( proto.table_id() ), "Trying to update unkown stringtable" );
+        REPLAY_CHECK( stringtables.has_index( proto.table_id() ), "Trying to update unkown stringtable" );
         auto& tbl = stringtables.by_index( proto.table_id() );
         tbl.value.update( &proto );
     }
 
+    entity* parser::acquire( uint32_t cls ) {
+        if ( recycled.size() <= cls )
+            recycled.resize( classes.classes.size() > cls ? classes.classes.size() : cls + 1 );
+
+        auto& l = recycled[cls];
+        entity* e;
+
+        if ( !l.empty() ) {
+            // Reuse storage of a deleted entity with the same class
+            e = l.back();
+            l.pop_back();
+            e->reset();
+        } else {
+            e           = g_entalloc.malloc();
+            e->cls      = cls;
+            e->cls_hash = classes.classes.by_index( cls )->hash;
+            e->type     = classes.classes.by_index( cls )->type;
+            e->set_serializer( &serializers->get( cls ), &serializers->get_layout( cls ) );
+        }
+
+        // Link into live lists
+        if ( cls_live.size() <= cls )
+            cls_live.resize( recycled.size(), nullptr );
+
+        e->cls_prev = nullptr;
+        e->cls_next = cls_live[cls];
+        if ( e->cls_next )
+            e->cls_next->cls_prev = e;
+        cls_live[cls] = e;
+
+        e->type_prev = nullptr;
+        e->type_next = type_live[e->type];
+        if ( e->type_next )
+            e->type_next->type_prev = e;
+        type_live[e->type] = e;
+
+        return e;
+    }
+
+    void parser::release( entity* e ) {
+        // Unlink from live lists
+        if ( e->cls_prev )
+            e->cls_prev->cls_next = e->cls_next;
+        else
+            cls_live[e->cls] = e->cls_next;
+
+        if ( e->cls_next )
+            e->cls_next->cls_prev = e->cls_prev;
+
+        if ( e->type_prev )
+            e->type_prev->type_next = e->type_next;
+        else
+            type_live[e->type] = e->type_next;
+
+        if ( e->type_next )
+            e->type_next->type_prev = e->type_prev;
+
+        e->cls_prev = e->cls_next = e->type_prev = e->type_next = nullptr;
+
+        if ( recycled.size() <= e->cls )
+            recycled.resize( e->cls + 1 );
+
+        recycled[e->cls].push_back( e );
+    }
+
     void parser::svc_handle_entities( const char* data, uint32_t size, visitor* v ) {
         CSVCMsg_PacketEntities proto;
-        ASSERT_TRUE( proto.ParseFromArray( data, size ), "Unable to parse protobuf packet" );
+        REPLAY_CHECK( proto.ParseFromArray( data, size ), "Unable to parse protobuf packet" );
 
         bitstream b( proto.entity_data() );
 
@@ -463,7 +571,7 @@ namespace butterfly {
             // Update entity index
             idx += b.readUBitVar() + 1;
 
-            ASSERT_TRUE( idx >= 0 && idx < BUTTERFLY_MAX_ENTS, "Invalid entity index" );
+            REPLAY_CHECK( idx >= 0 && idx < BUTTERFLY_MAX_ENTS, "Invalid entity index" );
 
             // Determine update type
             int32_t etype = 0;
@@ -484,42 +592,38 @@ namespace butterfly {
             // Handle update
             switch ( etype ) {
             case E_CREATE: {
-                uint32_t cls = b.read( classes.bits() );
-                b.read( 17 );      // serial
+                uint32_t cls    = b.read( classes.bits() );
+                uint32_t serial = b.read( 17 );
                 b.readVarUInt32(); // unkown
 
+                REPLAY_CHECK( cls < classes.classes.size(), "Invalid class id" );
+
                 // Free old entity if applicable
                 if ( entities[idx] ) {
-                    g_entalloc.free(entities[idx]);
-                    entities[idx] = nullptr;
+                    release( entities[idx] );
                 }
 
                 // Create new
-                if ( !entities[idx] ) {
-                    entities[idx] = g_entalloc.malloc();
-                }
+                entities[idx] = acquire( cls );
 
                 // Parse entity
                 entities[idx]->id       = idx;
-                entities[idx]->cls      = cls;
-                entities[idx]->cls_hash = classes.classes.by_index( cls )->hash;
-                entities[idx]->type     = classes.classes.by_index( cls )->type;
-                entities[idx]->set_serializer( &serializers->get( cls ) );
+                entities[idx]->serial   = serial;
 
                 const std::string bkey = std::to_string(cls);
                 if (baselines.has_key(bkey) && !baselines.by_key(bkey).value.empty()) {
                     bitstream b(baselines.by_key(bkey).value);
-                    entities[idx]->parse( b );
+                    entities[idx]->parse( b, *ctx );
                 }
 
-                entities[idx]->parse( b );
+                entities[idx]->parse( b, *ctx );
 
                 // Emit event
                 if ( v ) v->on_entity( ENT_CREATED, entities[idx] );
             } break;
             case E_UPDATE: {
-                ASSERT_TRUE( entities[idx], "Unable to find entity in update" );
-                entities[idx]->parse( b );
+                REPLAY_CHECK( entities[idx], "Unable to find entity in update" );
+                entities[idx]->parse( b, *ctx );
                 if ( v ) v->on_entity( ENT_UPDATED, entities[idx] );
             } break;
             case E_LEAVE: {
@@ -527,12 +631,14 @@ namespace butterfly {
             case E_DELETE: {
                 if ( entities[idx] ) {
                     if ( v ) v->on_entity( ENT_DELETED, entities[idx] );
-                    g_entalloc.free( entities[idx] );
+                    release( entities[idx] );
                 }
 
                 entities[idx] = nullptr;
             } break;
             }
         }
+
+        b.check();
     }
 } /* butterfly */
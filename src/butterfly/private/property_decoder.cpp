@@ -19,78 +19,89 @@
  *    limitations under the License.
  */
 
+#include <cstring>
+
 #include <butterfly/flattened_serializer.hpp>
 #include <butterfly/property.hpp>
-#include <butterfly/resources.hpp>
+#include <butterfly/quantized.hpp>
 
 #include <butterfly/util_bitstream.hpp>
 #include <butterfly/util_chash.hpp>
-#include "quantized.hpp"
 
 namespace butterfly {
     /* clang-format off */
 
-    const char* prop_decoder_name( fs& f ) {
-        if (f.decoder == prop_decode_qangle_pitch_yawn) return "QAngle (Pitch & Yawn)";
-        if (f.decoder == prop_decode_bool) return "Bool";
-        if (f.decoder == prop_decode_fixed64) return "Int64 (fixed length)";
-        if (f.decoder == prop_decode_coord) return "Coord";
-        if (f.decoder == prop_decode_dynamic) return "Dynamic Array";
-        if (f.decoder == prop_decode_float) return "Float";
-        if (f.decoder == prop_decode_simtime) return "Simulation Time";
-        if (f.decoder == prop_decode_normal) return "Normal (float)";
-        if (f.decoder == prop_decode_noscale) return "Noscale (float)";
-        if (f.decoder == prop_decode_quantized) return "Quantized (float)";
-        if (f.decoder == prop_decode_vector) return "Vector";
-        if (f.decoder == prop_decode_vector2d) return "VectorXY";
-        if (f.decoder == prop_decode_qangle) return "QAngle";
-        if (f.decoder == prop_decode_string) return "String";
-        if (f.decoder == prop_decode_varint) return "Varint";
-        if (f.decoder == prop_decode_resource) return "Resource Path";
+    const char* prop_decoder_name( const fs& f ) {
+        decoder_fcn* d = prop_decoder_generic( f.decoder );
+
+        if (d == prop_decode_qangle_pitch_yawn) return "QAngle (Pitch & Yawn)";
+        if (d == prop_decode_bool) return "Bool";
+        if (d == prop_decode_fixed64) return "Int64 (fixed length)";
+        if (d == prop_decode_coord) return "Coord";
+        if (d == prop_decode_dynamic) return "Dynamic Array";
+        if (d == prop_decode_float) return "Float";
+        if (d == prop_decode_simtime) return "Simulation Time";
+        if (d == prop_decode_normal) return "Normal (float)";
+        if (d == prop_decode_noscale) return "Noscale (float)";
+        if (d == prop_decode_quantized) return "Quantized (float)";
+        if (d == prop_decode_vector) return "Vector";
+        if (d == prop_decode_vector2d) return "VectorXY";
+        if (d == prop_decode_qangle) return "QAngle";
+        if (d == prop_decode_string) return "String";
+        if (d == prop_decode_varint) return "Varint";
+        if (d == prop_decode_resource) return "Resource Path";
 
         return "Unknown";
     }
 
+    uint8_t prop_decoder_type( decoder_fcn* d ) {
+        d = prop_decoder_generic( d );
+
+        if (d == prop_decode_bool) return property::V_BOOL;
+        if (d == prop_decode_fixed64) return property::V_UINT64;
+        if (d == prop_decode_dynamic) return property::V_ARRAY;
+        if (d == prop_decode_varint) return property::V_UINT64;
+        if (d == prop_decode_svarint) return property::V_INT64;
+        if (d == prop_decode_normal) return property::V_VECTOR;
+        if (d == prop_decode_vector) return property::V_VECTOR;
+        if (d == prop_decode_vector2d) return property::V_VECTOR;
+        if (d == prop_decode_qangle) return property::V_VECTOR;
+        if (d == prop_decode_qangle_pitch_yawn) return property::V_VECTOR;
+        if (d == prop_decode_quaternion) return property::V_QUATERNION;
+        if (d == prop_decode_vector4d) return property::V_QUATERNION;
+        if (d == prop_decode_string) return property::V_STRING;
+        if (d == prop_decode_resource) return property::V_RESOURCE;
+
+        return property::V_FLOAT;
+    }
+
     void prop_decode_bool( bitstream& b, fs_info* f, property* p ) {
         p->data.b = b.readBool();
-        p->type = property::V_BOOL;
     }
 
     void prop_decode_fixed64( bitstream& b, fs_info* f, property* p ) {
         p->data.u64 = (uint64_t)b.read(32) | ((uint64_t)b.read(32) << 32);
-        p->type = property::V_UINT64;
     }
 
     void prop_decode_coord( bitstream& b, fs_info* f, property* p ) {
         p->data.fl = b.readCoord();
-        p->type = property::V_FLOAT;
     }
 
     void prop_decode_dynamic( bitstream& b, fs_info* f, property* p ) {
         p->data.u64 = b.readVarUInt64();
-        p->type = property::V_UINT64;
     }
 
     void prop_decode_normal( bitstream& b, fs_info* f, property* p ) {
         p->data.vec = b.read3BitNormal();
-        p->type = property::V_VECTOR;
     }
 
     //** Internal inlined version */
     static force_inline float prop_decode_quantized_i( bitstream& b, fs_info* f ) {
-        // Leaks as well as breaks multi-usage. @todo: Fix
-        static std::vector<quantized_float_decoder*> decs(20480, nullptr);
-
-        if (!decs[f->field]) {
-            decs[f->field] = new quantized_float_decoder( f->bits, f->flags, f->min, f->max );
-        }
-
-        return decs[f->field]->decode( b );
+        return f->quantized.decode( b );
     }
 
     void prop_decode_quantized( bitstream& b, fs_info* f, property* p ) {
         p->data.fl = prop_decode_quantized_i( b, f );
-        p->type = property::V_FLOAT;
     }
 
     /** Internal inlined version */
@@ -102,7 +113,6 @@ namespace butterfly {
 
     void prop_decode_noscale( bitstream& b, fs_info* f, property* p ) {
         p->data.u32 = b.read(32);
-        p->type = property::V_FLOAT;
     }
 
     /** Internal inlined version */
@@ -120,13 +130,11 @@ namespace butterfly {
 
     void prop_decode_float( bitstream& b, fs_info* f, property* p ) {
         p->data.fl = prop_decode_float_i( b, f );
-        p->type = property::V_FLOAT;
     }
 
     void prop_decode_simtime( bitstream& b, fs_info* f, property* p ) {
         static constexpr float frame_time = (1.0f / 30.0f);
         p->data.fl = b.readVarUInt64() * frame_time;
-        p->type = property::V_FLOAT;
     }
 
     void prop_decode_quaternion( bitstream& b, fs_info* f, property* p ) {
@@ -136,8 +144,6 @@ namespace butterfly {
            prop_decode_float_i(b, f),
            prop_decode_float_i(b, f),
         }};
-
-        p->type = property::V_VECTOR;
     }
 
     void prop_decode_vector( bitstream& b, fs_info* f, property* p ) {
@@ -146,8 +152,6 @@ namespace butterfly {
            prop_decode_float_i(b, f),
            prop_decode_float_i(b, f)
         }};
-
-        p->type = property::V_VECTOR;
     }
 
     /** Decode vector2d */
@@ -157,8 +161,6 @@ namespace butterfly {
            prop_decode_float_i(b, f),
            0.0f
         }};
-
-        p->type = property::V_VECTOR;
     }
 
     /** Decode vector4d */
@@ -169,8 +171,6 @@ namespace butterfly {
            prop_decode_float_i(b, f),
            prop_decode_float_i(b, f)
         }};
-
-        p->type = property::V_VECTOR;
     }
 
     void prop_decode_qangle( bitstream& b, fs_info* f, property* p ) {
@@ -180,29 +180,15 @@ namespace butterfly {
                prop_decode_float_i(b, f),
                prop_decode_float_i(b, f)
             }};
-
-            p->type = property::V_VECTOR;
         } else {
-            std::array<float, 3> toSet{ {0.0f, 0.0f, 0.0f} };
-
             bool b1 = b.readBool();
             bool b2 = b.readBool();
             bool b3 = b.readBool();
 
-            // Get reference
-            if ( p->type == property::V_VECTOR ) {
-                toSet = p->data.vec;
-            }
-
-            if ( b1 ) toSet[0] = b.readCoord();
-            if ( b2 ) toSet[1] = b.readCoord();
-            if ( b3 ) toSet[2] = b.readCoord();
-
-            if ( p->type != property::V_VECTOR ) {
-                p->data.vec = toSet;
-            }
-
-            p->type = property::V_VECTOR;
+            // Cells start zeroed, so the previous value is always valid
+            if ( b1 ) p->data.vec[0] = b.readCoord();
+            if ( b2 ) p->data.vec[1] = b.readCoord();
+            if ( b3 ) p->data.vec[2] = b.readCoord();
         }
     }
 
@@ -212,38 +198,257 @@ namespace butterfly {
            b.readAngle(f->bits),
            0
         }};
-
-        p->type = property::V_VECTOR;
     }
 
     void prop_decode_string( bitstream& b, fs_info* f, property* p ) {
         char buffer[1024];
         b.readString( buffer, 1024 );
-        p->data_str = std::string(buffer);
-        p->type = property::V_STRING;
+        p->set_string( buffer, strnlen( buffer, 1024 ) );
     }
 
     void prop_decode_varint( bitstream& b, fs_info* f, property* p ) {
         p->data.u64 = b.readVarUInt64();
-        p->type = property::V_UINT64;
     }
 
     void prop_decode_svarint( bitstream& b, fs_info* f, property* p ) {
         p->data.u64 = b.readVarSInt64();
-        p->type = property::V_INT64;
     }
 
-    void prop_decode_resource( bitstream& b, fs_info* f, property* p ) {
-        uint64_t idx = b.readVarUInt64();
+    /** Float element decoders, one of them is chosen per field by prop_decoder_specialize */
+    struct float_coord {
+        static force_inline float decode( bitstream& b, fs_info* f ) { return b.readCoord(); }
+    };
+
+    struct float_noscale {
+        static force_inline float decode( bitstream& b, fs_info* f ) { return prop_decode_noscale_i( b, f ); }
+    };
+
+    struct float_quantized {
+        static force_inline float decode( bitstream& b, fs_info* f ) { return prop_decode_quantized_i( b, f ); }
+    };
+
+    /** Decodes a single float */
+    template <typename E>
+    static void prop_decode_float_t( bitstream& b, fs_info* f, property* p ) {
+        p->data.fl = E::decode( b, f );
+    }
+
+    /**
+     * Decodes N floats, into a vector for up to 3 with the remaining ones zeroed or into a quaternion.
+     *
+     * G is the generic decoder this replaces, it keeps e.g. vector and qangle apart for prop_decoder_generic.
+     */
+    template <decoder_fcn* G, typename E, uint32_t N>
+    static void prop_decode_floats_t( bitstream& b, fs_info* f, property* p ) {
+        float* out = N == 4 ? p->data.quat.data() : p->data.vec.data();
+
+        for ( uint32_t i = 0; i < N; ++i ) {
+            out[i] = E::decode( b, f );
+        }
+
+        if ( N == 2 )
+            out[2] = 0.0f;
+    }
+
+    /** Specialised decoders by generic one, indexed like float_kind */
+    static const struct {
+        decoder_fcn* generic;
+        decoder_fcn* spec[3];
+    } float_decoders[] = {
+        {prop_decode_float, {prop_decode_float_t<float_coord>, prop_decode_float_t<float_noscale>, prop_decode_float_t<float_quantized>}},
+        {prop_decode_vector,
+            {prop_decode_floats_t<prop_decode_vector, float_coord, 3>, prop_decode_floats_t<prop_decode_vector, float_noscale, 3>,
+                prop_decode_floats_t<prop_decode_vector, float_quantized, 3>}},
+        {prop_decode_vector2d,
+            {prop_decode_floats_t<prop_decode_vector2d, float_coord, 2>, prop_decode_floats_t<prop_decode_vector2d, float_noscale, 2>,
+                prop_decode_floats_t<prop_decode_vector2d, float_quantized, 2>}},
+        {prop_decode_vector4d,
+            {prop_decode_floats_t<prop_decode_vector4d, float_coord, 4>, prop_decode_floats_t<prop_decode_vector4d, float_noscale, 4>,
+                prop_decode_floats_t<prop_decode_vector4d, float_quantized, 4>}},
+        {prop_decode_quaternion,
+            {prop_decode_floats_t<prop_decode_quaternion, float_coord, 4>, prop_decode_floats_t<prop_decode_quaternion, float_noscale, 4>,
+                prop_decode_floats_t<prop_decode_quaternion, float_quantized, 4>}},
+        {prop_decode_qangle,
+            {prop_decode_floats_t<prop_decode_qangle, float_coord, 3>, prop_decode_floats_t<prop_decode_qangle, float_noscale, 3>,
+                prop_decode_floats_t<prop_decode_qangle, float_quantized, 3>}},
+    };
+
+    /** Returns the float element decoder used by prop_decode_float_i: 0 = coord, 1 = noscale, 2 = quantized */
+    static uint32_t float_kind( fs_info* f ) {
+        if ( f->encoder == "coord"_chash )
+            return 0;
+
+        if ( f->bits == 0 || f->bits >= 32 )
+            return 1;
+
+        return 2;
+    }
+
+    decoder_fcn* prop_decoder_specialize( decoder_fcn* d, fs_info* f ) {
+        // qangles without a bit count read a coord per set flag
+        if ( d == prop_decode_qangle && f->bits == 0 )
+            return d;
+
+        for ( auto& e : float_decoders ) {
+            if ( e.generic == d )
+                return e.spec[float_kind( f )];
+        }
+
+        return d;
+    }
+
+    decoder_fcn* prop_decoder_generic( decoder_fcn* d ) {
+        for ( auto& e : float_decoders ) {
+            for ( auto s : e.spec ) {
+                if ( s == d )
+                    return e.generic;
+            }
+        }
+
+        return d;
+    }
+
+    bool prop_decoder_quantized( decoder_fcn* d ) {
+        if ( d == prop_decode_quantized )
+            return true;
+
+        for ( auto& e : float_decoders ) {
+            if ( e.spec[2] == d )
+                return true;
+        }
+
+        return false;
+    }
+
+    /** Generic decoder and the name hashed into prop_decoder_table_hash */
+    struct decoder_id {
+        decoder_fcn* fcn;
+        const char* name;
+    };
+
+    /** Generic decoders by id, snapshots written with a different list are ignored */
+    static const decoder_id decoder_ids[] = {
+        {nullptr, "none"},
+        {prop_decode_bool, "bool"},
+        {prop_decode_fixed64, "fixed64"},
+        {prop_decode_coord, "coord"},
+        {prop_decode_dynamic, "dynamic"},
+        {prop_decode_float, "float"},
+        {prop_decode_simtime, "simtime"},
+        {prop_decode_normal, "normal"},
+        {prop_decode_noscale, "noscale"},
+        {prop_decode_quantized, "quantized"},
+        {prop_decode_quaternion, "quaternion"},
+        {prop_decode_vector, "vector"},
+        {prop_decode_vector2d, "vector2d"},
+        {prop_decode_vector4d, "vector4d"},
+        {prop_decode_qangle, "qangle"},
+        {prop_decode_qangle_pitch_yawn, "qangle_pitch_yawn"},
+        {prop_decode_string, "string"},
+        {prop_decode_varint, "varint"},
+        {prop_decode_svarint, "svarint"},
+        {prop_decode_resource, "resource"}
+    };
+
+    uint32_t prop_decoder_id( decoder_fcn* d ) {
+        d = prop_decoder_generic( d );
+
+        for ( uint32_t i = 0; i < sizeof( decoder_ids ) / sizeof( decoder_ids[0] ); ++i ) {
+            if ( decoder_ids[i].fcn == d )
+                return i;
+        }
+
+        ASSERT_TRUE( false, "Decoder without id" );
+        return 0;
+    }
+
+    decoder_fcn* prop_decoder_by_id( uint32_t id, bool& valid ) {
+        valid = id < sizeof( decoder_ids ) / sizeof( decoder_ids[0] );
+        return valid ? decoder_ids[id].fcn : nullptr;
+    }
+
+    uint64_t prop_decoder_table_hash() {
+        uint64_t hash = constexpr_hash_rt( "" );
+
+        // names include their terminator so neighbouring names can't merge
+        for ( auto& e : decoder_ids ) {
+            hash = constexpr_hash_rt( e.name, strlen( e.name ) + 1, hash );
+        }
+
+        return hash;
+    }
+
+    /** Stores the raw bits of N fixed width quantized floats, component i starts at bit i * f->bits */
+    template <uint32_t N>
+    static void prop_decode_deferred_t( bitstream& b, fs_info* f, property* p ) {
+        uint64_t raw = 0;
+        for ( uint32_t i = 0; i < N; ++i ) {
+            raw |= static_cast<uint64_t>( b.read( f->bits ) ) << ( i * f->bits );
+        }
+
+        p->data.u64 = raw;
+    }
 
-        if (idx == 0) {
-            p->data_str = "none";
-            p->type = property::V_STRING;
+    /** Converts the bits stored by prop_decode_deferred_t, layout is the same as for prop_decode_floats_t */
+    template <uint32_t N>
+    static void prop_convert_deferred_t( fs_info* f, property* p ) {
+        const uint64_t raw  = p->data.u64;
+        const uint64_t mask = ( 1ull << f->bits ) - 1;
+        float out[N];
+
+        for ( uint32_t i = 0; i < N; ++i ) {
+            out[i] = f->quantized.value( ( raw >> ( i * f->bits ) ) & mask );
+        }
+
+        if ( N == 1 ) {
+            p->data.fl = out[0];
         } else {
-            p->data_str = resource_lookup(idx);
-            p->type = property::V_STRING;
+            float* dst = N == 4 ? p->data.quat.data() : p->data.vec.data();
+            memcpy( dst, out, sizeof( out ) );
+
+            if ( N == 2 )
+                dst[2] = 0.0f;
         }
     }
 
+    decoder_fcn* prop_decoder_deferred( decoder_fcn* d, fs_info* f, convert_fcn** convert ) {
+        if ( !d || float_kind( f ) != 2 || !f->quantized.fixed_width() )
+            return nullptr;
+
+        d = prop_decoder_generic( d );
+
+        // number of components and the matching functions, qangles without bits have been ruled out above
+        uint32_t n       = 0;
+        decoder_fcn* ret = nullptr;
+
+        if ( d == prop_decode_float ) {
+            n        = 1;
+            ret      = prop_decode_deferred_t<1>;
+            *convert = prop_convert_deferred_t<1>;
+        } else if ( d == prop_decode_vector2d ) {
+            n        = 2;
+            ret      = prop_decode_deferred_t<2>;
+            *convert = prop_convert_deferred_t<2>;
+        } else if ( d == prop_decode_vector || d == prop_decode_qangle ) {
+            n        = 3;
+            ret      = prop_decode_deferred_t<3>;
+            *convert = prop_convert_deferred_t<3>;
+        } else if ( d == prop_decode_vector4d || d == prop_decode_quaternion ) {
+            n        = 4;
+            ret      = prop_decode_deferred_t<4>;
+            *convert = prop_convert_deferred_t<4>;
+        }
+
+        // raw bits have to fit the cell
+        if ( n * f->bits > 64 )
+            return nullptr;
+
+        return ret;
+    }
+
+    void prop_decode_resource( bitstream& b, fs_info* f, property* p ) {
+        p->data.u64 = b.readVarUInt64();
+    }
+
     /* clang-format on */
 } /* butterfly */
@@ -0,0 +1,104 @@
+/**
+ * @file quantized.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include <butterfly/quantized.hpp>
+#include "config_internal.hpp"
+
+namespace butterfly {
+    /** Decoder state a lookup table depends on */
+    typedef std::tuple<uint32_t, uint32_t, float, float, float> lut_key;
+
+    /** Tables currently in use, keyed by encoding */
+    static std::map<lut_key, std::weak_ptr<const std::vector<quantized_float_decoder::lut_entry>>> g_luts;
+
+    /** Map size at which expired tables are removed next */
+    static size_t g_lutsweep = 64;
+
+    // Lookup table lock
+    static std::mutex g_lutlock;
+
+    void quantized_float_decoder::assign_lut() {
+        // flag bits are read in front of the value and become part of the index
+        uint32_t fbits = ( ( flags & QFE_ROUNDDOWN ) != 0 ) + ( ( flags & QFE_ROUNDUP ) != 0 ) +
+                         ( ( flags & QFE_ENCODE_ZERO_EXACTLY ) != 0 );
+
+        if ( fbits + bc > BUTTERFLY_QUANTIZED_LUT_BITS )
+            return;
+
+        lut_bits = fbits + bc;
+        lut_key key{bc, static_cast<uint32_t>( flags ), min, max, decode_mul};
+
+        // serializers are built and loaded by concurrent parsers regardless of BUTTERFLY_THREADSAFE
+        std::lock_guard<std::mutex> lock( g_lutlock );
+
+        // tables of encodings no longer in use have been freed, drop their entries once the map has grown
+        if ( g_luts.size() >= g_lutsweep ) {
+            for ( auto it = g_luts.begin(); it != g_luts.end(); ) {
+                if ( it->second.expired() ) {
+                    it = g_luts.erase( it );
+                } else {
+                    ++it;
+                }
+            }
+
+            g_lutsweep = std::max<size_t>( 64, g_luts.size() * 2 );
+        }
+
+        lut = g_luts[key].lock();
+
+        if ( !lut ) {
+            auto entries = std::make_shared<std::vector<lut_entry>>( 1 << lut_bits );
+
+            // replays the branches of decode on every possible index
+            for ( uint32_t i = 0; i < entries->size(); ++i ) {
+                lut_entry& e = ( *entries )[i];
+                uint32_t pos = 0;
+
+                if ( flags & QFE_ROUNDDOWN && ( ( i >> pos++ ) & 1 ) ) {
+                    e = {min, pos};
+                    continue;
+                }
+
+                if ( flags & QFE_ROUNDUP && ( ( i >> pos++ ) & 1 ) ) {
+                    e = {max, pos};
+                    continue;
+                }
+
+                if ( flags & QFE_ENCODE_ZERO_EXACTLY && ( ( i >> pos++ ) & 1 ) ) {
+                    e = {0.0f, pos};
+                    continue;
+                }
+
+                e = {value( ( i >> pos ) & ( ( 1 << bc ) - 1 ) ), pos + bc};
+            }
+
+            lut         = entries;
+            g_luts[key] = lut;
+        }
+
+        lut_data = lut->data();
+    }
+} /* butterfly */
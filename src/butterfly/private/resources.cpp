@@ -66,4 +66,12 @@ namespace butterfly {
             return "unknown";
         }
     }
+
+    const std::string& resource_cache::get( uint64_t hash ) {
+        auto it = paths.find( hash );
+        if ( it != paths.end() )
+            return it->second;
+
+        return paths[hash] = hash ? resource_lookup( hash ) : "none";
+    }
 }
@@ -48,14 +48,14 @@ namespace butterfly {
             const std::string& tbl = table->string_data();
 
             // verify and get length
-            ASSERT_TRUE(
+            REPLAY_CHECK(
                 snappy::IsValidCompressedBuffer( tbl.c_str(), tbl.size() ), "Invalid snappy compression buffer" );
-            ASSERT_TRUE(
+            REPLAY_CHECK(
                 snappy::GetUncompressedLength( tbl.c_str(), tbl.size(), &size ), "Unable to get uncompressed length" );
 
             // uncompress
             data.resize( size );
-            ASSERT_TRUE( snappy::RawUncompress( tbl.c_str(), tbl.size(), &data[0] ), "Failed to decompress data" );
+            REPLAY_CHECK( snappy::RawUncompress( tbl.c_str(), tbl.size(), &data[0] ), "Failed to decompress data" );
             update( table->num_entries(), data );
         } else {
             update( table->num_entries(), table->string_data() );
@@ -103,6 +103,9 @@ namespace butterfly {
                 index = bstream.readVarUInt32() + 1;
             }
 
+            // one overrun check per entry, the reads themselves are unchecked
+            bstream.check();
+
             // reset key and value before re-reading them
             key[0]   = '\0';
             value[0] = '\0';
@@ -118,7 +121,7 @@ namespace butterfly {
                     const uint32_t sIndex  = ( delta_zero + bstream.read( 5 ) ) & 31;
                     const uint32_t sLength = bstream.read( 5 );
 
-                    ASSERT_LESS( sIndex, STRINGTABLE_KEY_HISTORY, "Invalid stringtable key-delta specified" );
+                    REPLAY_CHECK( sIndex < STRINGTABLE_KEY_HISTORY, "Invalid stringtable key-delta specified" );
 
                     if ( delta_pos < sIndex || keys[sIndex].size() < sLength ) {
                         bstream.readString( key, STRINGTABLE_MAX_KEY_SIZE );
@@ -154,7 +157,7 @@ namespace butterfly {
 
                     size = bstream.read( 17 );
 
-                    ASSERT_TRUE( size < STRINGTABLE_MAX_VALUE_SIZE, "Decompressed stringtable to big (value)" );
+                    REPLAY_CHECK( size < STRINGTABLE_MAX_VALUE_SIZE, "Decompressed stringtable to big (value)" );
                     bstream.readBytes( value, size );
 
                     if (isCompressed) {
@@ -162,15 +165,15 @@ namespace butterfly {
                         std::string uncomp_data;
 
                         // verify and get length
-                        ASSERT_TRUE( snappy::IsValidCompressedBuffer( value, size ), "Invalid snappy compression buffer (value)" );
-                        ASSERT_TRUE( snappy::GetUncompressedLength( value, size, &uncomp_size ), "Unable to get uncompressed length (value)" );
+                        REPLAY_CHECK( snappy::IsValidCompressedBuffer( value, size ), "Invalid snappy compression buffer (value)" );
+                        REPLAY_CHECK( snappy::GetUncompressedLength( value, size, &uncomp_size ), "Unable to get uncompressed length (value)" );
 
                         // uncompress
                         uncomp_data.resize( uncomp_size );
-                        ASSERT_TRUE( snappy::RawUncompress( value, size, &uncomp_data[0] ), "Failed to decompress data (value)" );
+                        REPLAY_CHECK( snappy::RawUncompress( value, size, &uncomp_data[0] ), "Failed to decompress data (value)" );
 
                         // save to value
-                        ASSERT_TRUE( size < STRINGTABLE_MAX_VALUE_SIZE, "Decompressed stringtable to big (value)" );
+                        REPLAY_CHECK( uncomp_size < STRINGTABLE_MAX_VALUE_SIZE, "Decompressed stringtable to big (value)" );
                         size = uncomp_size;
                         memcpy(value, uncomp_data.c_str(), size);
                     }
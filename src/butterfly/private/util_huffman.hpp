@@ -22,122 +22,94 @@
 #ifndef BUTTERFLY_UTIL_HUFFMAN_HPP
 #define BUTTERFLY_UTIL_HUFFMAN_HPP
 
-#include <iomanip>
-#include <queue>
-#include <unordered_map>
+#include <algorithm>
 #include <vector>
-#include <cstddef>
+#include <cstdint>
 
 namespace butterfly {
-    /** Node Interface */
-    struct HuffmanNode {
-        const uint32_t weight;
-        const uint32_t num;
-
-        HuffmanNode( uint32_t weight, uint32_t num ) : weight( weight ), num( num ) {}
-
-        virtual ~HuffmanNode(){};
+    /** Huffman code of a single symbol, the first bit in the stream is the MSB */
+    struct huffman_code {
+        /** Code bits */
+        uint32_t code;
+        /** Code length in bits */
+        uint32_t len;
     };
 
-    /** Branch node */
-    struct HuffmanBranch : public HuffmanNode {
-        HuffmanNode* left;
-        HuffmanNode* right;
-
-        HuffmanBranch( HuffmanNode* l, HuffmanNode* r, uint32_t num )
-            : HuffmanNode( l->weight + r->weight, num ), left( l ), right( r ) {}
-
-        virtual ~HuffmanBranch() final {
-            delete left;
-            delete right;
+    /**
+     * Builds the Huffman codes for a list of weights.
+     *
+     * Valve's Huffman-Tree uses a variation which takes the node number into account: nodes are numbered in
+     * the order they are created, leaves first, and of two nodes with the same weight the one with the higher
+     * number is merged first. The first node taken becomes the 0 branch of the new one.
+     *
+     * Nodes live in a flat array indexed by their number, the queue is a heap of node numbers.
+     */
+    inline std::vector<huffman_code> huffman_build( const std::vector<uint32_t>& weights ) {
+        struct node {
+            uint32_t weight;
+            uint32_t left;
+            uint32_t right;
+        };
+
+        const uint32_t n = weights.size();
+        std::vector<node> nodes;
+        std::vector<uint32_t> queue;
+
+        nodes.reserve( n * 2 );
+        queue.reserve( n );
+
+        for ( uint32_t i = 0; i < n; ++i ) {
+            nodes.push_back( node{weights[i], 0, 0} );
+            queue.push_back( i );
         }
-    };
-
-    /** Leaf node */
-    template <typename Value>
-    struct HuffmanLeaf : public HuffmanNode {
-        Value v;
-
-        HuffmanLeaf( uint32_t weight, Value v, uint32_t num ) : HuffmanNode( weight, num ), v( v ){};
-    };
 
-    /** Huffman compare template */
-    template <typename T>
-    int32_t huffman_compare( HuffmanNode* left, HuffmanNode* right );
+        // true if a is taken after b
+        auto later = [&nodes]( uint32_t a, uint32_t b ) {
+            if ( nodes[a].weight == nodes[b].weight )
+                return a < b;
 
-    /**
-     * Simple HuffmanCoding implementation.
-     * See wikipedia for an in-depth explanation.
-     */
-    template <typename Value>
-    class huffman {
-    public:
-        /** Build the huffman tree from given values and frequencies */
-        void build_tree( const std::vector<Value>& items ) {
-            // Valve's Huffman-Tree uses a variation which takes the node number into account
-            uint32_t num = 0;
-
-            // Priority queue to sort items by their relative weight
-            std::priority_queue<HuffmanNode*, std::vector<HuffmanNode*>, decltype( &huffman_compare<Value> )> queue(
-                &huffman_compare<Value> );
-
-            // Add all items
-            for ( auto& v : items ) {
-                queue.push( new HuffmanLeaf<Value>( v.weight, v, num++ ) );
-            }
+            return nodes[a].weight > nodes[b].weight;
+        };
 
-            // Branch each leaf until only a single one remains
-            while ( queue.size() > 1 ) {
-                HuffmanNode* left = queue.top();
-                queue.pop();
+        std::make_heap( queue.begin(), queue.end(), later );
 
-                HuffmanNode* right = queue.top();
-                queue.pop();
+        while ( queue.size() > 1 ) {
+            std::pop_heap( queue.begin(), queue.end(), later );
+            const uint32_t left = queue.back();
+            queue.pop_back();
 
-                HuffmanNode* branch = new HuffmanBranch( left, right, num++ );
-                queue.push( branch );
-            }
+            std::pop_heap( queue.begin(), queue.end(), later );
+            const uint32_t right = queue.back();
+            queue.pop_back();
 
-            tree = queue.top();
+            nodes.push_back( node{nodes[left].weight + nodes[right].weight, left, right} );
+            queue.push_back( nodes.size() - 1 );
+            std::push_heap( queue.begin(), queue.end(), later );
         }
 
-        /** Prints all tree codes */
-        void print_tree( HuffmanNode* node = nullptr, std::string prefix = "" ) {
-            if ( !node )
-                node = tree;
-
-            if ( const HuffmanLeaf<Value>* lf = dynamic_cast<HuffmanLeaf<Value>*>( node ) ) {
-                printf ("%20s: %-20s\n", lf->v.name.c_str(), prefix.c_str());
-            } else if ( const HuffmanBranch* in = dynamic_cast<HuffmanBranch*>( node ) ) {
-                std::string leftPrefix = prefix;
-                leftPrefix += "0";
-                print_tree( in->left, leftPrefix );
-
-                std::string rightPrefix = prefix;
-                rightPrefix += "1";
-                print_tree( in->right, rightPrefix );
-            }
-        }
+        // Walk the tree, branches are the only nodes with a number of n or above
+        std::vector<huffman_code> ret( n, huffman_code{0, 0} );
+        std::vector<std::pair<uint32_t, huffman_code>> stack;
 
-        /** Prints tree as decimal */
-        void print_tree_dec( HuffmanNode* node = nullptr, uint32_t dec = 0 ) {
-            if ( !node )
-                node = tree;
+        if ( n > 1 )
+            stack.push_back( {(uint32_t)nodes.size() - 1, huffman_code{0, 0}} );
 
-            if ( const HuffmanLeaf<Value>* lf = dynamic_cast<HuffmanLeaf<Value>*>( node ) ) {
-                printf ("%20s: %-20d\n", lf->v.name.c_str(), dec);
-            } else if ( const HuffmanBranch* in = dynamic_cast<HuffmanBranch*>( node ) ) {
-                uint32_t decL = dec << 1;
-                print_tree_dec( in->left, decL );
+        while ( !stack.empty() ) {
+            const auto cur = stack.back();
+            stack.pop_back();
 
-                uint32_t decR = ( dec << 1 ) + 1;
-                print_tree_dec( in->right, decR );
+            if ( cur.first < n ) {
+                ret[cur.first] = cur.second;
+                continue;
             }
+
+            const node& b = nodes[cur.first];
+            stack.push_back( {b.left, huffman_code{cur.second.code << 1, cur.second.len + 1}} );
+            stack.push_back( {b.right, huffman_code{( cur.second.code << 1 ) | 1, cur.second.len + 1}} );
         }
 
-    private:
-        HuffmanNode* tree;
-    };
+        return ret;
+    }
 } /* butterfly */
 
 #endif /* BUTTERFLY_UTIL_HUFFMAN_HPP */
@@ -27,30 +27,42 @@
 
 #include <string>
 #include <mutex>
-#include <unordered_map>
+#include <vector>
 #include <iostream>
 
+#include <butterfly/util_assert.hpp>
 #include <butterfly/util_chash.hpp>
+#include <butterfly/flattened_serializer.hpp>
 #include <butterfly/property.hpp>
 
 /// Entity mask for ehandles
 #define EMASK 0x3FFF
 #define ENULL 16777215
+/// Serial bits in networked ehandles
+#define ESERIAL_SHIFT 14
+#define ESERIAL_MASK 0x3FF
 
 namespace butterfly {
     // forward decl
     class bitstream;
-    struct fs;
+    struct entity_context;
+    struct parse_target;
 
     /** Single networked entity */
     class entity {
     public:
-        /** Properties, indexes by their hash */
-        std::unordered_map<uint64_t, property*> properties;
+        /** Properties, indexed by their slot in the class layout, use cell() for slots that may be deferred */
+        std::vector<property> properties;
+        /** Bitset of slots that have been received at least once */
+        std::vector<uint64_t> present;
+        /** Bitset of slots still holding the raw bits of a deferred float decoder */
+        std::vector<uint64_t> deferred;
         /** Baseline pointer, can be null */
         entity* baseline;
         /** Own entity ID in global list */
         uint32_t id;
+        /** Serial number, changes each time the slot is reused */
+        uint32_t serial;
         /** Class id */
         uint32_t cls : 24;
         /** Type */
@@ -59,6 +71,14 @@ namespace butterfly {
         uint64_t cls_hash;
         /** Serializer */
         const fs* ser;
+        /** Property layout of the serializer */
+        const fs_layout* layout;
+        /** Intrusive links of the parser's live list for this class */
+        entity* cls_prev;
+        entity* cls_next;
+        /** Intrusive links of the parser's live list for this type */
+        entity* type_prev;
+        entity* type_next;
 
         /** Constructor */
         entity();
@@ -69,20 +89,47 @@ namespace butterfly {
         /** Copy constructor */
         entity(const entity& e);
 
-        /** Set serialzier */
-        void set_serializer( const fs* serializer );
+        /** Set serialzier and allocate property storage */
+        void set_serializer( const fs* serializer, const fs_layout* layout );
 
-        /** Parse entity data from bitstream */
-        void parse( bitstream& b );
+        /**
+         * Reset the entity for reuse by a new entity of the same class.
+         *
+         * Clears all presence bits and zeroes the cells, string buffers and array storage are kept for reuse.
+         */
+        void reset();
 
-        /** Spew property to console */
-        void spew(std::ostream& out = std::cout);
+        /** Parse entity data from bitstream, ctx provides the scratch memory */
+        void parse( bitstream& b, entity_context& ctx );
+
+        /** Decode the values of already resolved fieldpaths, defer stores raw bits for fields supporting it */
+        void parse_values( bitstream& b, const std::vector<parse_target>& targets, bool defer );
+
+        /** Spew property to console, resource paths are resolved if a cache such as parser::resources is passed */
+        void spew(std::ostream& out = std::cout, resource_cache* resources = nullptr);
+
+        /** Returns the networked handle referencing this entity */
+        uint32_t handle() const { return id | ( ( serial & ESERIAL_MASK ) << ESERIAL_SHIFT ); }
+
+        /** Returns true if the property at the given slot has been received */
+        bool is_set( uint32_t slot ) const { return ( present[slot >> 6] >> ( slot & 63 ) ) & 1; }
+
+        /** Returns the cell at the given slot, converts deferred raw bits on first access */
+        property* cell( uint32_t slot ) {
+            if ( ( deferred[slot >> 6] >> ( slot & 63 ) ) & 1 ) {
+                const fs* f = layout->fields[slot];
+                f->convert( f->info, &properties[slot] );
+                deferred[slot >> 6] &= ~( 1ull << ( slot & 63 ) );
+            }
+
+            return &properties[slot];
+        }
 
         /** Returns true if field exists */
         bool has( uint64_t i ) {
-            auto i1 = properties.find( i );
-            if ( i1 != properties.end() ) {
-                return true;
+            const uint32_t slot = layout->find( i );
+            if ( slot != fs_layout::npos ) {
+                return is_set( slot );
             }
 
             return false;
@@ -93,9 +140,9 @@ namespace butterfly {
 
         /** Get field by id */
         property* get( uint64_t i ) {
-            auto i1 = properties.find( i );
-            if ( i1 != properties.end() ) {
-                return i1->second;
+            const uint32_t slot = layout->find( i );
+            if ( slot != fs_layout::npos && is_set( slot ) ) {
+                return cell( slot );
             }
 
             ASSERT_TRUE( 0 != 0, "Trying to access invalid property" );
@@ -105,10 +152,113 @@ namespace butterfly {
         /** Get field by string */
         property* get( const std::string& s ) { return get( constexpr_hash_rt( s.c_str() ) ); }
 
+        /**
+         * Get element field of a dynamic array.
+         *
+         * Fields are named after the array's own field with # in place of the index, e.g. "m_vecItems.#" for
+         * arrays of simple types or "m_vecItems.#.m_iId" for arrays of objects.
+         */
+        property* get( uint64_t array, uint32_t idx, uint64_t field ) {
+            const uint32_t slot = layout->find( array );
+            if ( slot != fs_layout::npos && is_set( slot ) && layout->fields[slot]->elements ) {
+                const fs_layout* el = layout->fields[slot]->elements;
+                const auto& arr     = properties[slot].data.arr;
+                const uint32_t i2   = el->find( field );
+
+                if ( idx < arr.size && i2 != fs_layout::npos ) {
+                    return &arr.data[idx * el->fields.size() + i2];
+                }
+            }
+
+            ASSERT_TRUE( 0 != 0, "Trying to access invalid array element" );
+            return nullptr;
+        }
+
+        /** Get element field of a dynamic array by string */
+        property* get( const std::string& array, uint32_t idx, const std::string& field ) {
+            return get( constexpr_hash_rt( array.c_str() ), idx, constexpr_hash_rt( field.c_str() ) );
+        }
+
+        /** Returns the number of elements of a dynamic array */
+        uint32_t size( uint64_t array ) { return get( array )->data.arr.size; }
+
+        /** Returns the number of elements of a dynamic array by string */
+        uint32_t size( const std::string& array ) { return size( constexpr_hash_rt( array.c_str() ) ); }
+
+        /** Returns serializer information (name, type) for the field */
+        const fs* field( uint64_t i ) {
+            const uint32_t slot = layout->find( i );
+            if ( slot != fs_layout::npos ) {
+                return layout->fields[slot];
+            }
+
+            ASSERT_TRUE( 0 != 0, "Trying to access invalid property" );
+            return nullptr;
+        }
+
+        /** Returns serializer information for field by string */
+        const fs* field( const std::string& s ) { return field( constexpr_hash_rt( s.c_str() ) ); }
+
     private:
         /** Mutex */
         std::mutex mut;
+
+        /** Release string and array storage */
+        void free_cells();
+    };
+
+    /** Iterable range over one of the intrusive live entity lists */
+    template <entity* entity::*Next>
+    class entity_range {
+    public:
+        /** Forward iterator */
+        class iterator {
+        public:
+            /** Constructor */
+            explicit iterator( entity* e ) : e( e ) {}
+
+            /** Returns the current entity */
+            entity* operator*() const { return e; }
+
+            /** Advance to next entity in list */
+            iterator& operator++() {
+                e = e->*Next;
+                return *this;
+            }
+
+            /** Compare iterators */
+            bool operator==( const iterator& o ) const { return e == o.e; }
+
+            /** Compare iterators */
+            bool operator!=( const iterator& o ) const { return e != o.e; }
+
+        private:
+            /** Current entity */
+            entity* e;
+        };
+
+        /** Constructor */
+        explicit entity_range( entity* head ) : head( head ) {}
+
+        /** Returns first entity */
+        iterator begin() const { return iterator( head ); }
+
+        /** Returns end of list */
+        iterator end() const { return iterator( nullptr ); }
+
+        /** Returns true if there are no entities in the list */
+        bool empty() const { return head == nullptr; }
+
+    private:
+        /** First entity */
+        entity* head;
     };
+
+    /** Live entities of one class */
+    typedef entity_range<&entity::cls_next> entity_class_range;
+
+    /** Live entities of one type */
+    typedef entity_range<&entity::type_next> entity_type_range;
 } /* butterfly */
 
 #endif /* BUTTERFLY_ENTITY_HPP */
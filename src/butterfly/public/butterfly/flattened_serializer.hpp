@@ -25,20 +25,26 @@
 #ifndef BUTTERFLY_FLATTENED_SERIALIZER_HPP
 #define BUTTERFLY_FLATTENED_SERIALIZER_HPP
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <cstdint>
 #include <iostream>
 
 #include <butterfly/proto/netmessages.pb.h>
 #include <butterfly/util_assert.hpp>
+#include <butterfly/util_bitstream.hpp>
 #include <butterfly/util_dict.hpp>
 #include <butterfly/util_noncopyable.hpp>
 #include <butterfly/property_decoder.hpp>
+#include <butterfly/quantized.hpp>
 
 namespace butterfly {
     // forward decl
     struct entity_classes;
+    struct fs_layout;
 
     /** Field information */
     struct fs_info {
@@ -60,6 +66,8 @@ namespace butterfly {
         float min;
         /** Max val */
         float max;
+        /** Decoder for quantized floats, built from bits, flags, min and max for fields decoded as such */
+        quantized_float_decoder quantized;
     };
 
     /** Type information about a property */
@@ -76,33 +84,149 @@ namespace butterfly {
         decoder_fcn* decoder;
         /** Normal information */
         fs_info* info;
+        /** Element decoder for dynamic arrays of simple types */
+        decoder_fcn* element;
     };
 
-    /** Flattened serializer table for a single networked class, points to decoder and property */
+    /**
+     * Flattened serializer node, points to decoder and property.
+     *
+     * Nodes are immutable once built and shared: a field referencing another serializer points to that
+     * serializer's node instead of copying it, and fixed size arrays store their element only once. Where a
+     * node ends up in a class is described by the class' fs_layout.
+     */
     struct fs {
-        /** Returns field at given position */
-        const fs& operator[]( uint32_t n ) const {
-            if ( info->dynamic && properties.size() == 1 ) {
-                return properties[0];
+        /** Returns the node holding the children, the shared serializer for fields referencing one */
+        const fs& members() const { return table ? *table : *this; }
+
+        /** Returns the number of children, 0 for dynamic arrays whose size is only known per entity */
+        uint32_t size() const {
+            const fs& m = members();
+            return m.elements ? 0 : m.count ? m.count : m.properties.size();
+        }
+
+        /** Returns child for the given fieldpath index, arrays return their element for every index */
+        const fs& child( uint32_t n ) const {
+            const fs& m = members();
+
+            // indices come from the replay, out of range ones mean it is corrupt
+            if ( m.elements || m.count ) {
+                REPLAY_CHECK( m.elements || n < m.count, "FS out-of-bounds" );
+                return m.properties[0];
             }
 
-            ASSERT_TRUE( n < properties.size(), "FS out-of-bounds" );
-            return properties[n];
+            REPLAY_CHECK( n < m.properties.size(), "FS out-of-bounds" );
+            return m.properties.data()[n];
+        }
+
+        /** Returns field at given position */
+        const fs& operator[]( uint32_t n ) const { return child( n ); }
+
+        /** Returns the slot of child n relative to the first slot after this node, not valid for dynamic arrays */
+        uint32_t offset( uint32_t n ) const {
+            const fs& m = members();
+            return m.count ? n * m.properties[0].span : m.properties[n].slot;
         }
 
-        /** List of fields / props */
+        /** Own children, a single one describing the element for arrays */
         std::vector<fs> properties;
+        /** Shared serializer this field refers to, its children are used in place of properties */
+        const fs* table = nullptr;
         /** Pointer to decoder */
-        decoder_fcn* decoder;
+        decoder_fcn* decoder = nullptr;
         /** Pointer to field info */
-        fs_info* info;
-        /** FS name */
+        fs_info* info = nullptr;
+        /** Decoder storing raw bits instead, null if the value can't be deferred */
+        decoder_fcn* deferred = nullptr;
+        /** Converts the raw bits stored by deferred */
+        convert_fcn* convert = nullptr;
+        /** Name relative to the parent, empty for elements of fixed size arrays which are named by index */
         std::string name;
-        /** Hash */
-        uint64_t hash;
+        /** Hash of name */
+        uint64_t hash = 0;
+        /** Property type of the decoded value, see property::types */
+        uint8_t type = 0;
+        /** Slot relative to the first slot of the parent's children */
+        uint32_t slot = 0;
+        /** Number of slots occupied by this node and its children, 1 for dynamic arrays */
+        uint32_t span = 1;
+        /** Number of elements if this is a fixed size array, properties[0] describes each of them */
+        uint32_t count = 0;
+        /** Element layout if this is a dynamic array, properties[0] describes a single element */
+        const fs_layout* elements = nullptr;
+    };
+
+    /**
+     * Flat property layout of a networked class, each serializer node owns one property slot per place it is used.
+     *
+     * Dynamic arrays occupy a single slot holding the element count and element storage. Each element is a
+     * block of cells described by the array's own element layout.
+     *
+     * A name is the parent slot plus the local name of the node, or its index for elements of fixed size arrays.
+     * Hashes continue the FNV state of the parent's hash and are only computed once a field is looked up. Full
+     * names are only joined once name is called. Both are safe to request from multiple threads.
+     */
+    struct fs_layout {
+        /** Returned by find for unknown fields */
+        static constexpr uint32_t npos = 0xFFFFFFFF;
+
+        /** Serializer node by slot */
+        std::vector<const fs*> fields;
+        /** Slot of the parent node by slot, npos for top-level fields */
+        std::vector<uint32_t> parents;
+        /** Slots holding string data */
+        std::vector<uint32_t> strings;
+        /** Slots holding dynamic arrays */
+        std::vector<uint32_t> arrays;
+        /** Prefix of top-level names, the name of the array for element layouts */
+        std::string root;
+
+        /** Returns the full name of the field at the given slot, e.g. "m_vecItems.0" */
+        const std::string& name( uint32_t slot ) const {
+            build_names();
+            return names[slot];
+        }
+
+        /** Returns the hash of name( slot ) */
+        uint64_t hash( uint32_t slot ) const {
+            build_hashes();
+            return hashes[slot];
+        }
+
+        /** Returns the slot of the field with the given name hash or npos */
+        uint32_t find( uint64_t hash ) const {
+            build_hashes();
+            auto it = slots.find( hash );
+            return it != slots.end() ? it->second : npos;
+        }
+
+    private:
+        /** Full names by slot */
+        mutable std::vector<std::string> names;
+        /** Name hashes by slot */
+        mutable std::vector<uint64_t> hashes;
+        /** Slot by name hash */
+        mutable std::unordered_map<uint64_t, uint32_t> slots;
+        /** Whether names have been built */
+        mutable std::atomic<bool> named{false};
+        /** Whether hashes and slots have been built */
+        mutable std::atomic<bool> hashed{false};
+
+        /** Points str at the local name of the node at slot and returns its length, array indices are printed to buf */
+        uint32_t local_name( uint32_t slot, const char*& str, char* buf ) const;
+
+        /** Builds names if they don't exist yet */
+        void build_names() const;
+
+        /** Builds hashes and slots if they don't exist yet */
+        void build_hashes() const;
     };
 
-    /**  Flattened serializer structure introduced in Source 2 */
+    /**
+     * Flattened serializer structure introduced in Source 2.
+     *
+     * Serializers are immutable once built and may be shared between parsers, see serializer_cache.
+     */
     class flattened_serializer : noncopyable {
     public:
         /** Initialize serializer from data */
@@ -115,30 +239,87 @@ namespace butterfly {
         void build( entity_classes& cls );
 
         /** Dump serializer at given index to console */
-        void spew( uint32_t idx, std::ostream& out = std::cout );
+        void spew( uint32_t idx, std::ostream& out = std::cout ) const;
 
         /** Return serializer at given index */
-        const fs& get( uint32_t idx );
+        const fs& get( uint32_t idx ) const;
+
+        /** Return property layout for serializer at given index */
+        const fs_layout& get_layout( uint32_t idx ) const;
 
         /** Returns original type-symbol as string */
-        std::string get_otype( fs_info* f );
+        std::string get_otype( fs_info* f ) const;
+
+        /**
+         * Writes the built serializers to a snapshot file tagged with key.
+         *
+         * Decoders are stored by id, nodes, field information and quantizer parameters by value. Layouts
+         * are derived from the nodes again when loading.
+         */
+        void save( const char* path, uint64_t key ) const;
+
+        /** Maps a snapshot written by save, null if it is missing, corrupt, from another build or has another key */
+        static std::shared_ptr<flattened_serializer> load( const char* path, uint64_t key );
 
     private:
+        /** Type and encoder symbols of a field */
+        struct field_symbols {
+            std::string type;
+            std::string encoder;
+        };
+
         /** Serializer data from replay */
         CSVCMsg_FlattenedSerializer serializers;
-        /** Flattening tables */
-        std::vector<fs> tables;
+        /** Networked tables by class id, pointing into tables_internal */
+        std::vector<const fs*> tables;
+        /** Property layouts, indexed like tables */
+        std::vector<fs_layout*> layouts;
+        /** Element layouts of dynamic arrays */
+        std::vector<fs_layout*> element_layouts;
         /** Tables indexed by name and position */
         dict<fs> tables_internal;
         /** Stores metadata per property */
         std::unordered_map<uint32_t, fs_typeinfo> metadata;
+        /** Symbols per property, the serializer message is not kept for snapshots */
+        std::unordered_map<uint32_t, field_symbols> symbols;
+
+        /** Constructor used when loading snapshots */
+        flattened_serializer() = default;
 
+        /** Creates the element layouts and class layouts from the built nodes */
+        void build_layouts();
         /** Spew implementation */
-        void spew_impl( uint32_t idx, void* tbl, std::string target = "", bool internal = false );
+        void spew_impl( uint32_t idx, void* tbl, std::string target = "", bool internal = false ) const;
         /** Returns metadata for field */
         fs_typeinfo& get_metadata( uint32_t field );
-        /** Fill string information */
-        void app_name_hash( std::string n, fs& f );
+    };
+
+    /**
+     * Process-wide cache of built serializers.
+     *
+     * Replays recorded on the same patch carry the same send tables and class info. Parsers look their
+     * serializers up by a hash of both and only build them on a miss. Cached serializers are shared read-only,
+     * the least recently used one is dropped once BUTTERFLY_SERIALIZER_CACHE entries exist. Parsers keep
+     * their serializers alive after eviction.
+     *
+     * With a snapshot directory set, misses are looked up on disk and new serializers are written there, so
+     * fresh processes skip the build as well.
+     */
+    struct serializer_cache {
+        /** Returns serializers for the given key from memory or the snapshot directory, null if neither has them */
+        static std::shared_ptr<const flattened_serializer> get( uint64_t key );
+
+        /** Stores serializers under the given key, also writes a snapshot if a directory is set */
+        static void put( uint64_t key, std::shared_ptr<const flattened_serializer> s );
+
+        /** Sets the directory snapshots are read from and written to, empty disables snapshots */
+        static void snapshots( const std::string& dir );
+
+        /** Returns the number of cached serializers */
+        static std::size_t size();
+
+        /** Drops all cached serializers */
+        static void clear();
     };
 } /* butterfly */
 
@@ -22,6 +22,8 @@
 #ifndef BUTTERFLY_PARSER_HPP
 #define BUTTERFLY_PARSER_HPP
 
+#include <memory>
+#include <string>
 #include <vector>
 #include <cstdint>
 
@@ -32,6 +34,7 @@
 #include <butterfly/eventlist.hpp>
 #include <butterfly/packets.hpp>
 #include <butterfly/particle.hpp>
+#include <butterfly/resources.hpp>
 #include <butterfly/stringtable.hpp>
 #include <butterfly/util_dict.hpp>
 #include <butterfly/util_noncopyable.hpp>
@@ -41,6 +44,7 @@ namespace butterfly {
     class flattened_serializer;
     class visitor;
     struct fs;
+    struct entity_context;
 
     /** Entry point for the replay parser */
     class parser : private noncopyable {
@@ -53,10 +57,12 @@ namespace butterfly {
         dict<stringtable> stringtables;
         /** Entity classes */
         entity_classes classes;
-        /** Serializers */
-        flattened_serializer* serializers;
+        /** Serializers, shared with other parsers reading the same patch */
+        std::shared_ptr<const flattened_serializer> serializers;
         /** Particle manager */
         particle_manager particles;
+        /** Resource paths of V_RESOURCE properties, which only store the hash */
+        resource_cache resources;
         /** List of baselines */
         std::vector<entity*> baselines;
         /** List of entities */
@@ -79,6 +85,14 @@ namespace butterfly {
             float pregamestart;
         };
 
+        /** Counters of the entity update shape cache */
+        struct shapeinfo {
+            /** Updates that reused memoized fieldpaths */
+            uint64_t hits;
+            /** Updates that decoded their fieldpaths */
+            uint64_t misses;
+        };
+
         /** Constructor */
         parser();
 
@@ -91,10 +105,14 @@ namespace butterfly {
         /** Reset parser state */
         void reset();
 
-        /** Parse a single packet */
+        /**
+         * Parse a single packet.
+         *
+         * Throws replay_corrupt if the replay is corrupt, the parser should be discarded afterwards.
+         */
         void parse( visitor* v );
 
-        /** Parses everything */
+        /** Parses everything, throws replay_corrupt if the replay is corrupt */
         void parse_all( visitor* v );
 
         /** Enabled forwarding of given packet id */
@@ -103,6 +121,43 @@ namespace butterfly {
         /** Seek to the given second in the replay */
         void seek( uint32_t time );
 
+        /** Returns the shape cache counters since the parser was created */
+        shapeinfo shape_info() const;
+
+        /**
+         * Enables deferred float decoding.
+         *
+         * Quantized floats, vectors and quaternions with a fixed bit width keep their raw bits and are only
+         * converted when read through entity::get or entity::cell. Reading entity::properties directly
+         * yields the raw bits for such fields.
+         */
+        void defer_floats( bool enable );
+
+        /** Returns all live entities of the given class id */
+        entity_class_range entities_of( uint32_t cls ) const {
+            return entity_class_range( cls < cls_live.size() ? cls_live[cls] : nullptr );
+        }
+
+        /** Returns all live entities of the given type, e.g. ENT_HERO */
+        entity_type_range entities_of_type( entity_types t ) const { return entity_type_range( type_live[t] ); }
+
+        /**
+         * Resolves a networked ehandle to the entity it references.
+         *
+         * Returns null for ENULL, for free slots and for handles whose serial does not match the current
+         * occupant of the slot, i.e. handles to entities that have since been deleted.
+         */
+        entity* resolve( uint32_t handle ) const {
+            if ( handle == ENULL )
+                return nullptr;
+
+            entity* e = entities[handle & EMASK];
+            if ( !e || ( e->serial & ESERIAL_MASK ) != ( ( handle >> ESERIAL_SHIFT ) & ESERIAL_MASK ) )
+                return nullptr;
+
+            return e;
+        }
+
     private:
         /** Intial seek position*/
         uint32_t seekPos;
@@ -110,6 +165,30 @@ namespace butterfly {
         /** Packets that are being forwarded */
         std::vector<bool> packets;
 
+        /** Scratch memory for entity decoding */
+        entity_context* ctx;
+
+        /** Flattened serializer buffer kept until the class info arrives */
+        std::string sendtables;
+
+        /** Hash of sendtables, combined with the class info to look up cached serializers */
+        uint64_t sendtables_hash;
+
+        /** Deleted entities kept per class id, their storage is reused by the next creation */
+        std::vector<std::vector<entity*>> recycled;
+
+        /** First live entity per class id */
+        std::vector<entity*> cls_live;
+
+        /** First live entity per type */
+        entity* type_live[ENT_UNIT + 1];
+
+        /** Returns a reset entity for the given class and links it into the live lists */
+        entity* acquire( uint32_t cls );
+
+        /** Unlinks an entity from the live lists and returns it to its class' recycle list */
+        void release( entity* e );
+
         /**
          * Handles the demo file header.
          *
@@ -118,10 +197,10 @@ namespace butterfly {
          */
         void dem_handle_file_header( dem_packet& p );
 
-        /** Handles the sendtable packet */
+        /** Handles the sendtable packet, serializers are built once the class info is known */
         void dem_handle_send_tables( dem_packet& p );
 
-        /** Handles the class info, maps all networked classes to their numeric ID */
+        /** Handles the class info, maps all networked classes to their numeric ID and sets up the serializers */
         void dem_handle_class_info( dem_packet& p );
 
         /** Handles all packets */
@@ -27,12 +27,17 @@
 #include <sstream>
 #include <vector>
 #include <cstdint>
+#include <cstring>
 
-#include <butterfly/flattened_serializer.hpp>
-#include <butterfly/util_assert.hpp>
+#include <butterfly/resources.hpp>
 
 namespace butterfly {
-    /** Dynamic entity property */
+    /**
+     * Dynamic entity property.
+     *
+     * A property is a compact 16 byte value cell. It does not know its own type, the type and decoder are
+     * stored once per field in the serializer (fs::type) that owns the cell.
+     */
     class property {
     public:
         /** Vector type */
@@ -41,6 +46,26 @@ namespace butterfly {
         /** Quaternion type */
         typedef std::array<float, 4> Quaternion;
 
+        /** String storage, the memory is owned by the cell */
+        struct String {
+            /** Null-terminated character data, can be null */
+            char* data;
+            /** Length excluding the terminator */
+            uint32_t size;
+            /** Allocated bytes */
+            uint32_t capacity;
+        };
+
+        /** Dynamic array storage, the element blocks are owned by the cell */
+        struct Array {
+            /** Element cells, size * stride properties where stride is the size of the element layout */
+            property* data;
+            /** Number of elements */
+            uint32_t size;
+            /** Number of allocated elements */
+            uint32_t capacity;
+        };
+
         /** Different variant types */
         enum types {
             V_BOOL,
@@ -50,14 +75,12 @@ namespace butterfly {
             V_UINT64,
             V_FLOAT,
             V_STRING,
-            V_VECTOR,    //< std::array<3, float>
-            V_ARRAY,     // Array of properties
-            V_QUATERNION // < std::array<4, float>
+            V_VECTOR,     //< std::array<3, float>
+            V_ARRAY,      // Dynamic array of property blocks
+            V_QUATERNION, // < std::array<4, float>
+            V_RESOURCE    // < uint64_t resource hash, resolved with parser::resources
         };
 
-        /** Property info */
-        const fs* info;
-
         /** Data storage */
         union u {
             bool b;
@@ -68,25 +91,43 @@ namespace butterfly {
             float fl;
             Vector vec;
             Quaternion quat;
+            String str;
+            Array arr;
         } data;
 
-        /** Data storage used if type == V_STRING */
-        std::string data_str;
-
-        /** Property type */
-        uint8_t type;
-
         /** Constructor */
         property() = default;
 
-        /** Destructor */
+        /** Destructor, strings are released by their owner via free_string */
         ~property() = default;
 
-        /** Copy constructor */
+        /** Copy constructor, shallow */
         property(const property&) = default;
 
-        /** Returns property as string */
-        std::string as_string() {
+        /** Assigns string data, reuses the existing buffer if possible */
+        void set_string( const char* str, uint32_t size ) {
+            if ( size + 1 > data.str.capacity || !data.str.data ) {
+                delete[] data.str.data;
+                data.str.capacity = size + 1;
+                data.str.data     = new char[data.str.capacity];
+            }
+
+            memcpy( data.str.data, str, size );
+            data.str.data[size] = '\0';
+            data.str.size       = size;
+        }
+
+        /** Releases string memory */
+        void free_string() {
+            delete[] data.str.data;
+            data.str = String{nullptr, 0, 0};
+        }
+
+        /** Returns string data, never null */
+        const char* c_str() const { return data.str.data ? data.str.data : ""; }
+
+        /** Returns property as string, the type is provided by the serializer, resources resolves V_RESOURCE paths */
+        std::string as_string( uint8_t type, resource_cache* resources = nullptr ) const {
             switch ( type ) {
             case V_BOOL:
                 return data.b ? "true" : "false";
@@ -101,7 +142,7 @@ namespace butterfly {
             case V_FLOAT:
                 return std::to_string( data.fl );
             case V_STRING:
-                return data_str;
+                return std::string( c_str(), data.str.size );
             case V_VECTOR: {
                 std::stringstream s( "" );
                 s << "[" << data.vec[0] << "|" << data.vec[1] << "|" << data.vec[2] << "]";
@@ -113,12 +154,16 @@ namespace butterfly {
               return s.str();
             } break;
             case V_ARRAY:
-                return "[Property List]";
+                return "[" + std::to_string( data.arr.size ) + " elements]";
+            case V_RESOURCE:
+                return resources ? resources->get( data.u64 ) : "resource " + std::to_string( data.u64 );
             default:
                 return "Unkown";
             }
         }
     };
+
+    static_assert( sizeof( property ) == 16, "Property cell exceeds 16 bytes" );
 } /* butterfly */
 
 #endif /* BUTTERFLY_PROPERTY_HPP */
@@ -22,6 +22,8 @@
 #ifndef BUTTERFLY_PROPERTY_DECODER_HPP
 #define BUTTERFLY_PROPERTY_DECODER_HPP
 
+#include <cstdint>
+
 namespace butterfly {
     /// Forward decl
     class bitstream;
@@ -32,8 +34,45 @@ namespace butterfly {
     /// Decoder function prototype
     typedef void( decoder_fcn )( bitstream&, fs_info*, property* );
 
+    /// Converts the raw bits stored by a deferred decoder into the decoded value, in place
+    typedef void( convert_fcn )( fs_info*, property* );
+
     /** Returns decoder name as string */
-    const char* prop_decoder_name( fs& f );
+    const char* prop_decoder_name( const fs& f );
+
+    /** Returns the property type written by the given decoder */
+    uint8_t prop_decoder_type( decoder_fcn* d );
+
+    /**
+     * Returns a decoder specialised on the float encoding of f, or d if there is none.
+     *
+     * Float, vector, quaternion and qangle decoders otherwise check the encoder and bit count of f for every
+     * single component they decode.
+     */
+    decoder_fcn* prop_decoder_specialize( decoder_fcn* d, fs_info* f );
+
+    /** Returns the generic decoder a specialised one has been created from, or d itself */
+    decoder_fcn* prop_decoder_generic( decoder_fcn* d );
+
+    /** Returns true if d decodes quantized floats, only those read fs_info::quantized */
+    bool prop_decoder_quantized( decoder_fcn* d );
+
+    /** Returns a stable id for the generic decoder of d, 0 for nullptr, used to store decoders on disk */
+    uint32_t prop_decoder_id( decoder_fcn* d );
+
+    /** Returns the generic decoder for the given id, sets valid to false for unknown ids */
+    decoder_fcn* prop_decoder_by_id( uint32_t id, bool& valid );
+
+    /** Returns a hash of the decoder ids, changes whenever decoders are added, removed or reordered */
+    uint64_t prop_decoder_table_hash();
+
+    /**
+     * Returns a decoder that only stores the raw bits of a value, or nullptr if the encoding of f has no fixed width.
+     *
+     * Supported are quantized floats, vectors and quaternions without flag bits. convert is set to the function
+     * that turns the raw bits into the value d would have decoded.
+     */
+    decoder_fcn* prop_decoder_deferred( decoder_fcn* d, fs_info* f, convert_fcn** convert );
 
     /** Decode boolean */
     void prop_decode_bool( bitstream& b, fs_info* f, property* p );
@@ -89,7 +128,7 @@ namespace butterfly {
     /** Decode standard varint (signed) */
     void prop_decode_svarint( bitstream& b, fs_info* f, property* p );
 
-    /** Decodes resource string */
+    /** Decodes resource hash, the path is looked up on demand via parser::resources */
     void prop_decode_resource( bitstream& b, fs_info* f, property* p );
 } /* butterfly */
 
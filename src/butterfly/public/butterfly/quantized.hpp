@@ -24,6 +24,8 @@
 
 #include <cmath>
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include <butterfly/util_bitstream.hpp>
 #include <butterfly/util_platform.hpp>
@@ -41,10 +43,21 @@ namespace butterfly {
             QFE_ENCODE_INTEGERS_EXACTLY = ( 1 << 3 )
         };
 
+        /** Precomputed result for one combination of flag and value bits */
+        struct lut_entry {
+            /** Decoded value */
+            float value;
+            /** Number of bits consumed */
+            uint32_t bits;
+        };
+
+        /** Default constructor, decodes as noscale */
+        quantized_float_decoder() : quantized_float_decoder( 0, 0, 0.0f, 1.0f ) {}
+
         /** Constructor, initialized the decoder */
         quantized_float_decoder( uint8_t bc, uint8_t eflags, float min, float max )
             : min( min ), max( max ), high_low_mul( 0.0f ), decode_mul( 0.0f ), bc( bc ), flags( 0 ),
-              encode_flags( eflags ), is_noscale( false ) {
+              encode_flags( eflags ), is_noscale( false ), lut_bits( 0 ), lut_data( nullptr ) {
             // force noscale decoding
             if ( bc == 0 || bc >= 32 ) {
                 is_noscale = true;
@@ -100,6 +113,8 @@ namespace butterfly {
                 if ( quantize( 0.0f ) == 0.0f )
                     flags &= ~QFE_ENCODE_ZERO_EXACTLY;
             }
+
+            assign_lut();
         }
 
         /** Default destructor */
@@ -108,6 +123,16 @@ namespace butterfly {
         /** Return whether to decode this as noscale */
         force_inline bool noscale() { return is_noscale; }
 
+        /** Returns true if every value is encoded in exactly bc bits, i.e. no flag bits are read */
+        bool fixed_width() const {
+            return !is_noscale && !( flags & ( QFE_ROUNDDOWN | QFE_ROUNDUP | QFE_ENCODE_ZERO_EXACTLY ) );
+        }
+
+        /** Returns the float for the quantized value u */
+        force_inline float value( uint32_t u ) {
+            return min + ( max - min ) * ( static_cast<float>( u ) * decode_mul );
+        }
+
         /** Set optimal decoding flags based on min / max value and encoding flags */
         void validate_flags() {
             flags = encode_flags;
@@ -170,6 +195,17 @@ namespace butterfly {
 
         /** Decode the float */
         float decode( bitstream& b ) {
+            if ( lut_data ) {
+                const lut_entry& e = lut_data[b.peek( lut_bits )];
+                b.consume( e.bits );
+                return e.value;
+            }
+
+            return decode_bits( b );
+        }
+
+        /** Decode the float without the lookup table, reads each flag bit on its own */
+        float decode_bits( bitstream& b ) {
             if ( flags & QFE_ROUNDDOWN && b.readBool() )
                 return min;
 
@@ -179,8 +215,7 @@ namespace butterfly {
             if ( flags & QFE_ENCODE_ZERO_EXACTLY && b.readBool() )
                 return 0.0f;
 
-            uint32_t u = b.read( bc );
-            return min + ( max - min ) * ( static_cast<float>( u ) * decode_mul );
+            return value( b.read( bc ) );
         }
 
     private:
@@ -200,6 +235,15 @@ namespace butterfly {
         uint8_t encode_flags : 4;
         /** Whether to decode as noscale */
         bool is_noscale;
+        /** Number of bits peeked for a table lookup */
+        uint8_t lut_bits;
+        /** Lookup table indexed by the next lut_bits bits, shared with all decoders of the same encoding */
+        std::shared_ptr<const std::vector<lut_entry>> lut;
+        /** Raw pointer into lut, nullptr if decoding without one */
+        const lut_entry* lut_data;
+
+        /** Attaches a lookup table if flag and value bits are small enough, see quantized.cpp */
+        void assign_lut();
     };
 } /* butterfly */
 
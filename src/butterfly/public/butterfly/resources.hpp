@@ -23,11 +23,29 @@
 #define BUTTERFLY_RESOURCES_HPP
 
 #include <string>
+#include <unordered_map>
 #include <cstdint>
 
 namespace butterfly {
     /** Lookup resources hash and return corresponding entry */
     std::string resource_lookup( uint64_t hash );
+
+    /** Memoizes resource_lookup, each path is only built once */
+    class resource_cache {
+    public:
+        /** Returns the path for the given hash, "none" for 0 */
+        const std::string& get( uint64_t hash );
+
+        /** Returns the number of cached paths */
+        std::size_t size() const { return paths.size(); }
+
+        /** Drops all cached paths */
+        void clear() { paths.clear(); }
+
+    private:
+        /** Path by hash */
+        std::unordered_map<uint64_t, std::string> paths;
+    };
 }
 
 #endif /* BUTTERFLY_RESOURCES_HPP */
@@ -31,6 +31,15 @@
 #include <cmath>
 #include <cstring>
 #include <cassert>
+#include <stdexcept>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif /* __BMI2__ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
 
 #include <butterfly/util_assert.hpp>
 #include <butterfly/util_platform.hpp>
@@ -54,14 +63,55 @@ namespace butterfly {
         0xffffffffff,    0x1ffffffffff,    0x3ffffffffff,    0x7ffffffffff,
         0xfffffffffff,   0x1fffffffffff,   0x3fffffffffff,   0x7fffffffffff,
         0xffffffffffff,  0x1ffffffffffff,  0x3ffffffffffff,  0x7ffffffffffff,
-        0xfffffffffffff, 0x1fffffffffffff, 0x3fffffffffffff, 0x7fffffffffffff
+        0xfffffffffffff, 0x1fffffffffffff, 0x3fffffffffffff, 0x7fffffffffffff,
+        0xffffffffffffff, 0x1ffffffffffffff, 0x3ffffffffffffff, 0x7ffffffffffffff,
+        0xfffffffffffffff, 0x1fffffffffffffff, 0x3fffffffffffffff, 0x7fffffffffffffff
     };
     /* clang-format on */
 
+    /** Packs the low 7 bits of each byte of a varint into a contiguous value */
+    force_inline uint64_t varint_pack( uint64_t x ) {
+#ifdef __BMI2__
+        return _pext_u64( x, 0x7f7f7f7f7f7f7f7full );
+#else
+        // merge neighbouring 7 bit groups into 14, 28 and finally 56 bit ones
+        x &= 0x7f7f7f7f7f7f7f7full;
+        x = ( ( x & 0x7f007f007f007f00ull ) >> 1 ) | ( x & 0x007f007f007f007full );
+        x = ( ( x & 0x3fff00003fff0000ull ) >> 2 ) | ( x & 0x00003fff00003fffull );
+        x = ( ( x & 0x0fffffff00000000ull ) >> 4 ) | ( x & 0x000000000fffffffull );
+        return x;
+#endif /* __BMI2__ */
+    }
+
     /** Return int with bit set at given position */
     static constexpr uint64_t bit_at( uint8_t bit ) { return ( 1 << bit ); }
 
-    /** Read-Only bitstream implementation */
+    /** Thrown when a replay contains data the parser can't handle, e.g. indices or sizes out of range */
+    class replay_corrupt : public std::runtime_error {
+    public:
+        explicit replay_corrupt( const char* what ) : std::runtime_error( what ) {}
+    };
+
+    /** Thrown when data past the end of a bitstream has been read, i.e. on corrupt replays */
+    class bitstream_overflow : public replay_corrupt {
+    public:
+        bitstream_overflow() : replay_corrupt( "Bitstream overflow" ) {}
+    };
+
+/// Throws replay_corrupt if X is not true, used instead of ASSERT_TRUE for checks on replay data
+#define REPLAY_CHECK( X, MESSAGE )                                                                                     \
+    do {                                                                                                               \
+        if ( !expect( (bool)( X ), 1 ) )                                                                               \
+            throw ::butterfly::replay_corrupt( MESSAGE );                                                              \
+    } while ( 0 )
+
+    /**
+     * Read-Only bitstream implementation.
+     *
+     * Single value reads are unchecked. Reading past the end yields unspecified bits from the padding tail
+     * but never touches memory outside of the buffer, callers check() once per message or entity. Block
+     * reads check their length themselves. Both report corrupt data by throwing bitstream_overflow.
+     */
     class bitstream {
     public:
         /** Type used to keep track of the stream position */
@@ -75,19 +125,18 @@ namespace butterfly {
             // Check size requirements
             ASSERT_LESS( size, 0xffffffff, "Bitstream to large" );
 
-            // Reserve the memory in beforehand so we can just memcpy everything
-            data = new uint32_t[( str.size() + 3 ) / 4 + 1];
+            data = alloc( str.size() );
             memcpy( &data[0], str.c_str(), str.size() );
         }
 
         /** Copy-Constructor */
         bitstream( const bitstream& b ) : data( nullptr ), pos( b.pos ), size( b.size ), owns( true ) {
-            data = new uint32_t[( ( size >> 3 ) + 3 ) / 4 + 1];
+            data = alloc( size >> 3 );
             memcpy( &data[0], &b.data[0], ( size >> 3 ) );
         }
 
         /** Move-Constructor */
-        bitstream( bitstream&& b ) : data( b.data ), pos( b.pos ), size( b.size ) {
+        bitstream( bitstream&& b ) : data( b.data ), pos( b.pos ), size( b.size ), owns( b.owns ) {
             b.data = nullptr;
             b.pos  = 0;
             b.size = 0;
@@ -128,26 +177,35 @@ namespace butterfly {
         /** Sets bitstream position */
         inline void setPosition( const size_type s ) { pos = s; }
 
+        /** Throws bitstream_overflow if the stream has been read past its end */
+        force_inline void check() const {
+            if ( expect( pos > size, 0 ) )
+                throw bitstream_overflow();
+        }
+
         /**
          * Returns result of reading n bits into an uint32_t.
          *
-         * This function can read a maximum of 32 bits at once. If the amount of data requested
-         * exceeds the remaining size of the current chunk it wraps around to the next one.
+         * This function can read a maximum of 32 bits at once, they are taken from a single unaligned
+         * 64 bit load.
          */
         force_inline uint32_t read( const size_type n ) {
-            // make sure the data read fits the return type
-            ASSERT_LESS( n, size - pos, "Bitstream overflow" );
-            ASSERT_LESS( n, 33, "Trying to read more than 32 bits" );
-
-            static constexpr uint32_t bitSize = sizeof( uint32_t ) << 3; // size of chunk in bits
-            const uint32_t start              = pos >> 5;                // current active chunk
-            const uint32_t end                = ( pos + n - 1 ) >> 5;    // next chunk if data needs to be wrapped
-            const uint32_t shift              = ( pos & 31 );            // shift amount
-
+            const uint32_t ret = window() & masks[n];
             pos += n;
-            return ( ( data[start] >> shift ) | ( data[end] << ( bitSize - shift ) ) ) & masks[n];
+
+            return ret;
         }
 
+        /**
+         * Returns the next n bits without advancing the stream.
+         *
+         * Can be used to look at up to 32 bits past the end of the stream, those bits are zero.
+         */
+        force_inline uint32_t peek( const size_type n ) const { return window() & masks[n]; }
+
+        /** Advances the stream by n bits after a peek */
+        force_inline void consume( const size_type n ) { pos += n; }
+
         /**
          * Seek n bits forward.
          *
@@ -175,46 +233,51 @@ namespace butterfly {
 
         /** Reads a boolean */
         bool readBool() {
-            bool ret = ( data[pos >> 5] & bit_at( pos & 31 ) );
+            bool ret = window() & 1;
             pos += 1;
 
             return ret;
         }
 
-        /** Reads a variable sized uint32_t from the stream. */
+        /**
+         * Reads a variable sized uint32_t from the stream.
+         *
+         * All VARINT32_MAX bytes fit into one window, the first byte without continuation bit is found with a
+         * bit scan. Stops after VARINT32_MAX bytes if every one of them has the continuation bit set.
+         */
         uint32_t readVarUInt32() {
-            uint32_t readCount = 0;
-            uint32_t value     = 0;
+            const uint64_t w    = window();
+            const uint64_t term = ~w & 0x8080808080ull;
+            const uint32_t bits = term ? ctz64( term ) + 1 : VARINT32_MAX * 8;
 
-            char tmpBuf;
-            do {
-                if ( readCount == VARINT32_MAX ) // return when maximum number of iterations is reached
-                    return value;
-
-                tmpBuf = (char)read( 8 );
-                value |= ( uint32_t )( tmpBuf & 0x7F ) << ( 7 * readCount );
-                ++readCount;
-            } while ( tmpBuf & 0x80 );
-
-            return value;
+            pos += bits;
+            return varint_pack( w & masks[bits] );
         }
 
-        /** Reads a variable sized uint64_t from the stream. */
+        /**
+         * Reads a variable sized uint64_t from the stream.
+         *
+         * The first 7 bytes come from one window, only longer varints need a second one for the last 3.
+         */
         uint64_t readVarUInt64() {
-            uint32_t readCount = 0;
-            uint64_t value     = 0;
+            const uint64_t w    = window();
+            const uint64_t term = ~w & 0x80808080808080ull;
 
-            uint32_t tmpBuf;
-            do {
-                if ( readCount == VARINT64_MAX )
-                    return value;
+            if ( expect( term != 0, 1 ) ) {
+                const uint32_t bits = ctz64( term ) + 1;
+
+                pos += bits;
+                return varint_pack( w & masks[bits] );
+            }
 
-                tmpBuf = read( 8 );
-                value |= static_cast<uint64_t>( tmpBuf & 0x7F ) << ( 7 * readCount );
-                ++readCount;
-            } while ( tmpBuf & 0x80 );
+            pos += 56;
 
-            return value;
+            const uint64_t w2    = window();
+            const uint64_t term2 = ~w2 & 0x808080ull;
+            const uint32_t bits  = term2 ? ctz64( term2 ) + 1 : ( VARINT64_MAX - 7 ) * 8;
+
+            pos += bits;
+            return varint_pack( w & masks[56] ) | ( varint_pack( w2 & masks[bits] ) << 49 );
         }
 
         /**
@@ -238,168 +301,290 @@ namespace butterfly {
          * Reads a null-terminated string into the buffer, stops once it reaches \0 or n chars.
          *
          * n is treated as the number of bytes to be read.
-         * n can be arbitrarily large in this context. The underlying read method throws in case an overflow
-         * happens.
+         * n can be arbitrarily large in this context. Bytes are copied in blocks and searched for the
+         * terminator as they go, the buffer may be written past the terminator but never past n.
          */
         void readString( char* buffer, const size_type n ) {
-            if ( ( pos & 7 ) == 0 ) {
-                uint8_t* cbuf = (uint8_t*)&data[0] + ( pos >> 3 );
+            check();
+
+            const uint8_t* src   = reinterpret_cast<const uint8_t*>( data ) + ( pos >> 3 );
+            const uint32_t shift = pos & 7;
+            const size_type max  = ( size - pos ) >> 3;
+            const size_type lim  = n < max ? n : max;
+            size_type i          = 0;
+
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            for ( ; i + 16 <= lim; i += 16 ) {
+                const __m128i v = load_shifted16( src + i, shift );
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( buffer + i ), v );
+
+                const uint32_t z = _mm_movemask_epi8( _mm_cmpeq_epi8( v, zero ) );
+                if ( z ) {
+                    pos += ( i + ctz64( z ) + 1 ) * 8;
+                    return;
+                }
+            }
+#endif /* __SSE2__ */
 
-                for ( std::size_t i = 0; i < n; ++i ) {
-                    buffer[i] = ( cbuf[i] );
+            for ( ; i + 8 <= lim; i += 8 ) {
+                const uint64_t v = load_shifted( src + i, shift );
+                memcpy( buffer + i, &v, sizeof( v ) );
 
-                    if ( buffer[i] == '\0' ) {
-                        pos += i * 8 + 8;
-                        break;
-                    }
+                // lowest byte that is zero, higher ones may be false positives
+                const uint64_t z = ( v - 0x0101010101010101ull ) & ~v & 0x8080808080808080ull;
+                if ( z ) {
+                    pos += ( i + ( ctz64( z ) >> 3 ) + 1 ) * 8;
+                    return;
                 }
-            } else {
-                for ( std::size_t i = 0; i < n; ++i ) {
-                    buffer[i] = static_cast<char>( read( 8 ) );
+            }
+
+            for ( ; i < lim; ++i ) {
+                buffer[i] = static_cast<char>( load_shifted( src + i, shift ) );
 
-                    if ( buffer[i] == '\0' )
-                        break;
+                if ( buffer[i] == '\0' ) {
+                    pos += ( i + 1 ) * 8;
+                    return;
                 }
             }
+
+            if ( lim != n )
+                throw bitstream_overflow();
+
+            pos += lim * 8;
         }
 
         /**
          * Reads the exact number of bits into the buffer.
          *
-         * The function reads in chunks of 8 bit until n is smaller than that
-         * and appends the left over bits
+         * Full bytes are copied with readBytes, the left over bits are appended
          */
         void readBits( char* buffer, const size_type n ) {
-            size_type remaining = n;
-            size_type i         = 0;
-
-            while ( remaining >= 8 ) {
-                buffer[i++] = read( 8 );
-                remaining -= 8;
-            }
+            readBytes( buffer, n >> 3 );
 
-            if ( remaining > 0 )
-                buffer[i++] = read( remaining );
+            if ( n & 7 )
+                buffer[n >> 3] = read( n & 7 );
         }
 
-        /** Reads exact number of bytes */
+        /**
+         * Reads exact number of bytes.
+         *
+         * Unaligned positions copy 16 or 8 shifted bytes per iteration instead of reading them one by one.
+         */
         void readBytes( char* buffer, const size_type n ) {
-            // optimization if byte aligned
-            if ( ( pos & 7 ) == 0 ) {
-                uint8_t* cbuf = (uint8_t*)&data[0];
-                memcpy( buffer, &cbuf[( pos >> 3 )], n );
-                pos += n * 8;
+            check();
+
+            if ( expect( n * 8 > size - pos, 0 ) )
+                throw bitstream_overflow();
+
+            const uint8_t* src   = reinterpret_cast<const uint8_t*>( data ) + ( pos >> 3 );
+            const uint32_t shift = pos & 7;
+            pos += n * 8;
 
+            // optimization if byte aligned
+            if ( shift == 0 ) {
+                memcpy( buffer, src, n );
                 return;
             }
 
-            for ( uint32_t i = 0; i < n; ++i ) {
-                buffer[i] = read( 8 );
+            size_type i = 0;
+
+#ifdef __SSE2__
+            for ( ; i + 16 <= n; i += 16 ) {
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( buffer + i ), load_shifted16( src + i, shift ) );
+            }
+#endif /* __SSE2__ */
+
+            for ( ; i + 8 <= n; i += 8 ) {
+                const uint64_t v = load_shifted( src + i, shift );
+                memcpy( buffer + i, &v, sizeof( v ) );
+            }
+
+            if ( i < n ) {
+                const uint64_t v = load_shifted( src + i, shift );
+                memcpy( buffer + i, &v, n - i );
             }
         }
 
-        /** Reads a ubitvar, valve's own variable-length integer encoding. */
+        /**
+         * Reads a ubitvar, valve's own variable-length integer encoding.
+         *
+         * 4 low bits, followed by a 2 bit selector for 0, 4, 8 or 28 additional high bits.
+         */
         uint32_t readUBitVar() {
-            uint32_t nId = read( 6 );
-
-            switch ( nId & 0x30 ) {
-            case 16:
-                nId = ( nId & 15 ) | ( read( 4 ) << 4 );
-                break;
-            case 32:
-                nId = ( nId & 15 ) | ( read( 8 ) << 4 );
-                break;
-            case 48:
-                nId = ( nId & 15 ) | ( read( 28 ) << 4 );
-                break;
-            }
+            static constexpr uint8_t extra[4] = {0, 4, 8, 28};
 
-            return nId;
+            const uint64_t w = window();
+            const uint32_t n = extra[( w >> 4 ) & 3];
+
+            pos += 6 + n;
+            return ( w & 15 ) | ( ( w >> 6 ) & masks[n] ) << 4;
         }
 
-        /** Reads a fieldpath varint */
+        /**
+         * Reads a fieldpath varint.
+         *
+         * Up to 4 prefix bits, the position of the first set one selects a 2, 4, 10, 17 or 31 bit value.
+         */
         int32_t readFPBitVar() {
-            if ( readBool() )
-                return read( 2 );
-            if ( readBool() )
-                return read( 4 );
-            if ( readBool() )
-                return read( 10 );
-            if ( readBool() )
-                return read( 17 );
-            return read( 31 );
-        }
-
-        /** Reads coord */
-        float readCoord() {
-            float val = 0;
+            static constexpr uint8_t prefix[5] = {1, 2, 3, 4, 4};
+            static constexpr uint8_t width[5]  = {2, 4, 10, 17, 31};
 
-            uint32_t intval   = readBool();
-            uint32_t fractval = readBool();
-            bool signbit      = false;
+            const uint64_t w = window();
+            const uint32_t k = ctz64( w | 16 );
 
-            if ( intval != 0 || fractval != 0 ) {
-                signbit = readBool();
+            pos += prefix[k] + width[k];
+            return ( w >> prefix[k] ) & masks[width[k]];
+        }
 
-                if ( intval )
-                    intval = read( 14 ) + 1;
+        /**
+         * Reads coord.
+         *
+         * Integer and fraction flag, a sign bit if either is set, then 14 integer bits and 5 fraction bits
+         * if their flag is set. All of it fits into one window, the flags select with masks.
+         */
+        float readCoord() {
+            const uint64_t w   = window();
+            const uint32_t i   = w & 1;
+            const uint32_t f   = ( w >> 1 ) & 1;
+            const uint32_t any = i | f;
 
-                if ( fractval )
-                    fractval = read( 5 );
+            const uint32_t intval   = ( ( w >> 3 ) & 0x3fff ) + 1;
+            const uint32_t fractval = ( w >> ( 3 + 14 * i ) ) & 31;
+            const uint32_t sign     = ( w >> 2 ) & any;
 
-                val = intval + static_cast<float>( fractval ) * ( 1.0f / ( 1 << 5 ) );
-            }
+            pos += 2 + any * ( 1 + 14 * i + 5 * f );
 
-            if ( signbit )
-                return -val;
-            else
-                return val;
+            const float val = ( intval & -i ) + static_cast<float>( fractval & -f ) * ( 1.0f / ( 1 << 5 ) );
+            return flip_sign( val, sign );
         }
 
         /** Reads an angle */
         float readAngle( uint32_t n ) {
-            return static_cast<float>( read( n ) ) * 360.0f / static_cast<float>( 1 << n );
+            // 2^-n is exact, so the multiplication matches a division by 2^n
+            return static_cast<float>( read( n ) ) * 360.0f * exp2_neg( n );
         }
 
         /** Reads a normalized float */
         float readNormal() {
-            bool signbit = readBool();
-            uint16_t len = read( 11 );
-            float ret    = static_cast<float>( len ) * ( 1.0f / static_cast<float>( 1 << 11 ) - 1.0f );
+            const uint64_t w = window();
+            pos += 12;
 
-            if ( signbit )
-                return -ret;
-            else
-                return ret;
+            return normal( w );
         }
 
-        /** Reads a normalized vector */
+        /**
+         * Reads a normalized vector.
+         *
+         * The presence flags and both components are taken from one window, absent components are masked to
+         * +0.0f. Float sqrt is bit-exact with the double precision one for every possible input.
+         */
         std::array<float, 3> read3BitNormal() {
-            std::array<float, 3> ret{{0.0f, 0.0f, 0.0f}};
+            const uint64_t w    = window();
+            const uint32_t hasX = w & 1;
+            const uint32_t hasY = ( w >> 1 ) & 1;
+            const uint32_t offY = 2 + 12 * hasX;
+            const uint32_t offZ = offY + 12 * hasY;
 
-            bool hasX = readBool();
-            bool hasY = readBool();
+            std::array<float, 3> ret{{mask_float( normal( w >> 2 ), hasX ), mask_float( normal( w >> offY ), hasY ),
+                0.0f}};
 
-            if ( hasX )
-                ret[0] = readNormal();
-            if ( hasY )
-                ret[1] = readNormal();
+            const uint32_t negZ = ( w >> offZ ) & 1;
+            pos += offZ + 1;
 
-            bool negZ     = readBool();
-            float prodsum = ret[0] * ret[0] + ret[1] * ret[1];
+            const float prodsum = ret[0] * ret[0] + ret[1] * ret[1];
+            ret[2]              = flip_sign( prodsum < 1.0f ? sqrtf( 1.0f - prodsum ) : 0.0f, negZ );
 
-            if ( prodsum < 1.0f )
-                ret[2] = sqrt( 1.0 - prodsum );
-            else
-                ret[2] = 0.0f;
+            return ret;
+        }
 
-            if ( negZ )
-                ret[2] = -ret[2];
+    private:
+        /**
+         * Number of zeroed bytes past the end of each buffer.
+         *
+         * window() loads up to 8 of them, the shifted block copies up to 16.
+         */
+        static constexpr size_t padding = 16;
+
+        /** Allocates a buffer of n bytes plus zeroed padding */
+        static uint32_t* alloc( size_t n ) {
+            uint32_t* ret = new uint32_t[( n + padding + 3 ) / 4];
+            memset( reinterpret_cast<uint8_t*>( ret ) + n, 0, ( ( n + padding + 3 ) & ~3 ) - n );
 
             return ret;
         }
 
-    private:
+        /** Negates f if sign is 1, works on the bit pattern so -0.0f is preserved */
+        static force_inline float flip_sign( float f, uint32_t sign ) {
+            uint32_t u;
+            memcpy( &u, &f, sizeof( u ) );
+            u ^= sign << 31;
+            memcpy( &f, &u, sizeof( f ) );
+
+            return f;
+        }
+
+        /** Returns f if keep is 1 and +0.0f otherwise */
+        static force_inline float mask_float( float f, uint32_t keep ) {
+            uint32_t u;
+            memcpy( &u, &f, sizeof( u ) );
+            u &= -keep;
+            memcpy( &f, &u, sizeof( f ) );
+
+            return f;
+        }
+
+        /** Returns 2^-n, built from the exponent bits */
+        static force_inline float exp2_neg( uint32_t n ) {
+            const uint32_t u = ( 127 - n ) << 23;
+            float f;
+            memcpy( &f, &u, sizeof( f ) );
+
+            return f;
+        }
+
+        /** Decodes a normal from a sign bit followed by 11 bits of length */
+        static force_inline float normal( uint64_t w ) {
+            const float ret = static_cast<float>( ( w >> 1 ) & 0x7ff ) * ( 1.0f / static_cast<float>( 1 << 11 ) - 1.0f );
+            return flip_sign( ret, w & 1 );
+        }
+
+        /** Unaligned 64 bit load */
+        static force_inline uint64_t load64( const uint8_t* p ) {
+            uint64_t ret;
+            memcpy( &ret, p, sizeof( ret ) );
+
+            return ret;
+        }
+
+        /** Returns the 8 bytes starting shift bits into p, reads up to p + 16 */
+        static force_inline uint64_t load_shifted( const uint8_t* p, uint32_t shift ) {
+            // split left shift keeps shift == 0 defined
+            return ( load64( p ) >> shift ) | ( ( load64( p + 8 ) << 1 ) << ( 63 - shift ) );
+        }
+
+#ifdef __SSE2__
+        /** Returns the 16 bytes starting shift bits into p, reads up to p + 24 */
+        static force_inline __m128i load_shifted16( const uint8_t* p, uint32_t shift ) {
+            const __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) );
+            const __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i*>( p + 8 ) );
+
+            return _mm_or_si128( _mm_srl_epi64( lo, _mm_cvtsi32_si128( shift ) ),
+                _mm_sll_epi64( _mm_slli_epi64( hi, 1 ), _mm_cvtsi32_si128( 63 - shift ) ) );
+        }
+#endif /* __SSE2__ */
+
+        /**
+         * Returns at least 57 bits starting at the current position, the first one in the lowest bit.
+         *
+         * A single unaligned 64 bit load from the byte containing pos, shifted by the bit offset into that byte.
+         * Positions past the end are clamped to it, which keeps unchecked reads inside the padding tail.
+         */
+        force_inline uint64_t window() const {
+            const size_type p = pos < size ? pos : size;
+            return load64( reinterpret_cast<const uint8_t*>( data ) + ( p >> 3 ) ) >> ( p & 7 );
+        }
+
         /** Data to read from */
         uint32_t* data;
         /** Current position in the vector in bits */
@@ -56,6 +56,17 @@ namespace butterfly {
         return hash;
     }
 
+    /** Computes the FNV-1a hash of size bytes, continuing from hash to chain multiple buffers */
+    force_inline uint64_t constexpr_hash_rt(
+        const char* data, std::size_t size, uint64_t hash = detail::constexpr_hash_basis ) {
+        for ( std::size_t i = 0; i < size; ++i ) {
+            hash ^= data[i];
+            hash *= detail::constexpr_hash_prime;
+        }
+
+        return hash;
+    }
+
     /** User defined literal to allow "str"_chash-style invocation */
     force_inline constexpr uint64_t operator"" _chash( const char* str, size_t n ) { return constexpr_hash( str ); }
 } /* butterfly */
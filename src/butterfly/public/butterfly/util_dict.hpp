@@ -87,7 +87,7 @@ namespace butterfly {
         const_iterator cend() { return entries.cend(); }
 
         /** Returns size of list */
-        size_t size() { return entries.size(); }
+        size_t size() const { return entries.size(); }
 
         /** Reserves memory for a certain number of entries */
         void reserve( const size_type size ) { entries.reserve( size ); }
@@ -123,6 +123,9 @@ namespace butterfly {
         /** Returns entry by index */
         typename std::vector<entry_t>::reference by_index( std::size_t idx ) { return entries[idx]; }
 
+        /** Returns entry by index */
+        typename std::vector<entry_t>::const_reference by_index( std::size_t idx ) const { return entries[idx]; }
+
     private:
         /** Key -> Index Mapping */
         std::unordered_map<std::string, std::size_t> keyMap;
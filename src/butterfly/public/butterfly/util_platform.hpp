@@ -25,9 +25,19 @@
 #ifdef __GNUC__
 #define expect( __expr, __c ) __builtin_expect( ( __expr ), ( __c ) )
 #define force_inline __attribute__( ( always_inline ) ) inline
+#define ctz64( __x ) __builtin_ctzll( __x )
 #else
 #define expect( __expr, __c ) __expr
 #define force_inline inline
+
+/** Number of trailing zero bits, x must not be 0 */
+inline int ctz64( unsigned long long x ) {
+    int n = 0;
+    for ( ; !( x & 1 ); x >>= 1 )
+        ++n;
+
+    return n;
+}
 #endif /* __GNUC */
 
 #endif /* BUTTERFLY_UTIL_PLATFORM_HPP */
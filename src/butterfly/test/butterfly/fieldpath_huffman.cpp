@@ -0,0 +1,111 @@
+/**
+ * @file fieldpath_huffman.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <catch.hpp>
+#include <cstring>
+#include <random>
+#include <string>
+#include "../../private/fieldpath_huffman.hpp"
+
+using namespace butterfly;
+
+/* clang-format off */
+/** Huffman code of each fieldop as used by the game, read bit by bit from the stream with the first bit as MSB */
+static const struct {
+    uint32_t code;
+    uint16_t op;
+    const char* name;
+} fieldop_codes[] = {
+    {0, 0, "PlusOne"},
+    {2, 39, "FieldPathEncodeFinish"},
+    {14, 1, "PlusTwo"},
+    {15, 11, "PushOneLeftDeltaNRightNonZeroPack6Bits"},
+    {24, 8, "PushOneLeftDeltaOneRightNonZero"},
+    {26, 4, "PlusN"},
+    {50, 2, "PlusThree"},
+    {51, 29, "PopAllButOnePlusOne"},
+    {217, 10, "PushOneLeftDeltaNRightNonZero"},
+    {218, 7, "PushOneLeftDeltaOneRightZero"},
+    {220, 9, "PushOneLeftDeltaNRightZero"},
+    {222, 32, "PopAllButOnePlusNPack6Bits"},
+    {223, 3, "PlusFour"},
+    {432, 30, "PopAllButOnePlusN"},
+    {438, 12, "PushOneLeftDeltaNRightNonZeroPack8Bits"},
+    {439, 37, "NonTopoPenultimatePlusOne"},
+    {442, 31, "PopAllButOnePlusNPack3Bits"},
+    {443, 26, "PushNAndNonTopological"},
+    {866, 38, "NonTopoComplexPack4Bits"},
+    {1735, 36, "NonTopoComplex"},
+    {3469, 5, "PushOneLeftDeltaZeroRightZero"},
+    {27745, 27, "PopOnePlusOne"},
+    {27749, 6, "PushOneLeftDeltaZeroRightNonZero"},
+    {55488, 35, "PopNAndNonTopographical"},
+    {55489, 34, "PopNPlusN"},
+    {55492, 25, "PushN"},
+    {55493, 24, "PushThreePack5LeftDeltaN"},
+    {55494, 33, "PopNPlusOne"},
+    {55495, 28, "PopOnePlusN"},
+    {55496, 13, "PushTwoLeftDeltaZero"},
+    {110994, 15, "PushThreeLeftDeltaZero"},
+    {110995, 14, "PushTwoPack5LeftDeltaZero"},
+    {111000, 21, "PushTwoLeftDeltaN"},
+    {111001, 20, "PushThreePack5LeftDeltaOne"},
+    {111002, 23, "PushThreeLeftDeltaN"},
+    {111003, 22, "PushTwoPack5LeftDeltaN"},
+    {111004, 17, "PushTwoLeftDeltaOne"},
+    {111005, 16, "PushThreePack5LeftDeltaZero"},
+    {111006, 19, "PushThreeLeftDeltaOne"},
+    {111007, 18, "PushTwoPack5LeftDeltaOne"},
+};
+/* clang-format on */
+
+TEST_CASE( "fieldop codes", "[fieldpath_huffman.hpp]" ) {
+    REQUIRE( sizeof( fieldop_codes ) / sizeof( fieldop_codes[0] ) == fieldpath_operations.size() );
+
+    std::mt19937 rng( 42 );
+
+    for ( auto& c : fieldop_codes ) {
+        // the leading bit of every code but "0" is set
+        uint32_t len = 1;
+        while ( c.code >> len )
+            ++len;
+
+        // first bit in the stream is the MSB of the code
+        uint32_t rev = 0;
+        for ( uint32_t i = 0; i < len; ++i ) {
+            rev |= ( ( c.code >> ( len - 1 - i ) ) & 1 ) << i;
+        }
+
+        // whatever follows the code must not change the result
+        for ( uint32_t n = 0; n < 16; ++n ) {
+            const uint64_t bits = rev | ( static_cast<uint64_t>( rng() ) << len );
+
+            std::string str( 16, '\0' );
+            memcpy( &str[0], &bits, sizeof( bits ) );
+            bitstream b( str );
+
+            const fieldop* op = fieldop_decode( b );
+            REQUIRE( op == &fieldpath_operations[c.op] );
+            REQUIRE( strcmp( op->name, c.name ) == 0 );
+            REQUIRE( b.position() == len );
+        }
+    }
+}
@@ -0,0 +1,211 @@
+/**
+ * @file flattened_serializer.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <catch.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <butterfly/entity_classes.hpp>
+#include <butterfly/flattened_serializer.hpp>
+
+using namespace butterfly;
+
+/** Builds a serializer message field by field */
+struct serializer_message {
+    CSVCMsg_FlattenedSerializer msg;
+
+    /** Returns the index of the given symbol, adds it if it doesn't exist yet */
+    int symbol( const std::string& s ) {
+        for ( int i = 0; i < msg.symbols_size(); ++i ) {
+            if ( msg.symbols( i ) == s )
+                return i;
+        }
+
+        msg.add_symbols( s );
+        return msg.symbols_size() - 1;
+    }
+
+    /** Adds a field, fields referencing another serializer pass its name as ser */
+    int field( const char* name, const char* type, int bits = 0, const char* ser = nullptr, float lo = 0, float hi = 1 ) {
+        auto* f = msg.add_fields();
+        f->set_var_name_sym( symbol( name ) );
+        f->set_var_type_sym( symbol( type ) );
+        f->set_bit_count( bits );
+
+        if ( bits ) {
+            f->set_low_value( lo );
+            f->set_high_value( hi );
+        }
+
+        if ( ser ) {
+            f->set_field_serializer_name_sym( symbol( ser ) );
+            f->set_field_serializer_version( 0 );
+        }
+
+        return msg.fields_size() - 1;
+    }
+
+    /** Adds a serializer made of the given fields */
+    void serializer( const char* name, std::vector<int> fields ) {
+        auto* s = msg.add_serializers();
+        s->set_serializer_name_sym( symbol( name ) );
+        s->set_serializer_version( 0 );
+
+        for ( int f : fields ) {
+            s->add_fields_index( f );
+        }
+    }
+};
+
+/** Nodes have to match recursively, including their decoders */
+static void compare_nodes( const fs& a, const fs& b ) {
+    REQUIRE( a.name == b.name );
+    REQUIRE( a.hash == b.hash );
+    REQUIRE( a.type == b.type );
+    REQUIRE( a.slot == b.slot );
+    REQUIRE( a.span == b.span );
+    REQUIRE( a.count == b.count );
+    REQUIRE( a.decoder == b.decoder );
+    REQUIRE( a.deferred == b.deferred );
+    REQUIRE( ( !a.deferred || a.convert == b.convert ) );
+    REQUIRE( !a.table == !b.table );
+    REQUIRE( !a.elements == !b.elements );
+    REQUIRE( !a.info == !b.info );
+    REQUIRE( a.properties.size() == b.properties.size() );
+
+    if ( a.info ) {
+        REQUIRE( a.info->name == b.info->name );
+        REQUIRE( a.info->encoder == b.info->encoder );
+        REQUIRE( a.info->bits == b.info->bits );
+        REQUIRE( a.info->flags == b.info->flags );
+        REQUIRE( a.info->min == b.info->min );
+        REQUIRE( a.info->max == b.info->max );
+    }
+
+    if ( a.table )
+        compare_nodes( *a.table, *b.table );
+
+    for ( size_t i = 0; i < a.properties.size(); ++i ) {
+        compare_nodes( a.properties[i], b.properties[i] );
+    }
+}
+
+/** Layouts have to match slot by slot, including the element layouts of dynamic arrays */
+static void compare_layouts( const fs_layout& a, const fs_layout& b ) {
+    REQUIRE( a.fields.size() == b.fields.size() );
+    REQUIRE( a.parents == b.parents );
+    REQUIRE( a.strings == b.strings );
+    REQUIRE( a.arrays == b.arrays );
+
+    for ( uint32_t i = 0; i < a.fields.size(); ++i ) {
+        REQUIRE( a.name( i ) == b.name( i ) );
+        REQUIRE( a.hash( i ) == b.hash( i ) );
+        REQUIRE( b.find( b.hash( i ) ) == i );
+
+        if ( a.fields[i]->elements )
+            compare_layouts( *a.fields[i]->elements, *b.fields[i]->elements );
+    }
+}
+
+TEST_CASE( "serializer snapshot", "[flattened_serializer.hpp]" ) {
+    serializer_message m;
+
+    int x = m.field( "m_x", "int32" );
+    int v = m.field( "m_v", "Vector", 10, nullptr, -10, 10 );
+    int s = m.field( "m_s", "char[32]" );
+    m.serializer( "Inner", {x, v, s} );
+
+    int la = m.field( "m_a", "float32", 8, nullptr, 0, 100 );
+    int lb = m.field( "m_b", "uint8" );
+    m.serializer( "CAnimationLayer", {la, lb} );
+
+    int mi = m.field( "m_inner", "CPlayerLocalData", 0, "Inner" );
+    int mf = m.field( "m_flags", "bool[4]" );
+    int ml = m.field( "m_layers", "CUtlVector< CAnimationLayer >", 0, "CAnimationLayer" );
+    int mh = m.field( "m_handles", "CUtlVector< CHandle< CBaseEntity > >" );
+    m.serializer( "Mid", {mi, mf, ml, mh} );
+
+    int hp  = m.field( "m_hp", "int32" );
+    int m1  = m.field( "m_mid", "CPlayerLocalData", 0, "Mid" );
+    int pos = m.field( "m_pos", "Vector", 12, nullptr, -100, 100 );
+    int fa  = m.field( "m_fa", "float32[3]", 6, nullptr, 0, 1 );
+    m.serializer( "Top", {hp, m1, mi, pos, fa} );
+
+    entity_classes cls;
+    cls.classes.insert( 0, "Top", entity_classes::class_info{1, 0} );
+    cls.classes.insert( 1, "Mid", entity_classes::class_info{2, 0} );
+    cls.classes.insert( 2, "Unused", entity_classes::class_info{3, 0} );
+
+    std::string buf = m.msg.SerializeAsString();
+    flattened_serializer built( (uint8_t*)buf.data(), buf.size() );
+    built.build( cls );
+
+    // nested serializers and dynamic arrays are part of the comparison
+    REQUIRE( built.get_layout( 0 ).fields.size() > 10 );
+    REQUIRE( !built.get_layout( 1 ).arrays.empty() );
+
+    const char* path = "butterfly_test_snapshot.bfs";
+    built.save( path, 42 );
+
+    // other keys and missing files are rejected
+    REQUIRE( !flattened_serializer::load( path, 43 ) );
+    REQUIRE( !flattened_serializer::load( "butterfly_test_missing.bfs", 42 ) );
+
+    auto loaded = flattened_serializer::load( path, 42 );
+    REQUIRE( loaded );
+
+    for ( uint32_t i = 0; i < cls.classes.size(); ++i ) {
+        compare_nodes( built.get( i ), loaded->get( i ) );
+        compare_layouts( built.get_layout( i ), loaded->get_layout( i ) );
+    }
+
+    // truncated files are rejected
+    FILE* fp = fopen( path, "rb" );
+    REQUIRE( fp );
+    std::string data( 1 << 20, '\0' );
+    data.resize( fread( &data[0], 1, data.size(), fp ) );
+    fclose( fp );
+
+    for ( size_t n = 0; n < data.size(); n += 7 ) {
+        fp = fopen( path, "wb" );
+        fwrite( data.data(), 1, n, fp );
+        fclose( fp );
+
+        REQUIRE( !flattened_serializer::load( path, 42 ) );
+    }
+
+    remove( path );
+}
+
+TEST_CASE( "serializer array length", "[flattened_serializer.hpp]" ) {
+    serializer_message m;
+
+    // lengths given as constants can't be resolved and must not be guessed
+    int x = m.field( "m_x", "uint8[MAX_UNKNOWN]" );
+    m.serializer( "Top", {x} );
+
+    entity_classes cls;
+    cls.classes.insert( 0, "Top", entity_classes::class_info{1, 0} );
+
+    std::string buf = m.msg.SerializeAsString();
+    flattened_serializer built( (uint8_t*)buf.data(), buf.size() );
+    REQUIRE_THROWS_AS( built.build( cls ), replay_corrupt );
+}
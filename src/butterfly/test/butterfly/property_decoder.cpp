@@ -0,0 +1,150 @@
+/**
+ * @file property_decoder.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <catch.hpp>
+#include <cstring>
+#include <random>
+#include <string>
+#include <butterfly/flattened_serializer.hpp>
+#include <butterfly/property.hpp>
+#include <butterfly/property_decoder.hpp>
+#include <butterfly/util_chash.hpp>
+
+using namespace butterfly;
+
+/** Generic float decoders that have specialised versions */
+static decoder_fcn* float_generic[] = {prop_decode_float, prop_decode_vector, prop_decode_vector2d, prop_decode_vector4d,
+    prop_decode_quaternion, prop_decode_qangle};
+
+/** Returns a float field with a random encoding, kind 0 is coord, 1 is noscale and 2 is quantized */
+static fs_info random_info( std::mt19937& rng, uint32_t kind ) {
+    const float ranges[][2] = {{0.0f, 1.0f}, {-1.0f, 1.0f}, {-4096.0f, 4096.0f}, {0.0f, 360.0f}, {-100.0f, 0.0f}};
+    auto& r                 = ranges[rng() % 5];
+
+    fs_info f{};
+    f.encoder = kind == 0 ? "coord"_chash : 0;
+    f.bits    = kind == 1 ? ( rng() % 2 ) * 32 : 1 + rng() % 20;
+    f.flags   = rng() % 16;
+    f.min     = r[0];
+    f.max     = r[1];
+
+    if ( kind == 2 )
+        f.quantized = quantized_float_decoder( f.bits, f.flags, f.min, f.max );
+
+    return f;
+}
+
+/** Returns a random stream of 64 to 320 bytes */
+static std::string random_stream( std::mt19937& rng ) {
+    std::string str( 64 + rng() % 256, '\0' );
+    for ( auto& c : str ) {
+        c = (char)rng();
+    }
+
+    return str;
+}
+
+/**
+ * Compares the bit patterns of the values decoded by d, floats and vectors share the storage of quaternions.
+ *
+ * Only the float itself is compared for single floats, deferred decoders leave their raw bits behind it.
+ */
+static bool same_value( decoder_fcn* d, property& a, property& b ) {
+    const size_t size = d == prop_decode_float ? sizeof( float ) : sizeof( a.data.quat );
+    return memcmp( a.data.quat.data(), b.data.quat.data(), size ) == 0;
+}
+
+/** Decodes str with d1 and d2 value by value, both have to agree on values and positions */
+static void compare_decoders( decoder_fcn* d1, decoder_fcn* d2, fs_info& f, const std::string& str ) {
+    bitstream b1( str );
+    bitstream b2( str );
+
+    while ( b1.remaining() > 256 ) {
+        property p1, p2;
+        p1.data.quat = {{0.0f, 0.0f, 0.0f, 0.0f}};
+        p2.data.quat = {{0.0f, 0.0f, 0.0f, 0.0f}};
+
+        d1( b1, &f, &p1 );
+        d2( b2, &f, &p2 );
+
+        REQUIRE( same_value( d1, p1, p2 ) );
+        REQUIRE( b1.position() == b2.position() );
+    }
+}
+
+TEST_CASE( "property decoder specialize", "[property_decoder.hpp]" ) {
+    std::mt19937 rng( 1337 );
+
+    for ( uint32_t run = 0; run < 2000; ++run ) {
+        decoder_fcn* d = float_generic[rng() % 6];
+        fs_info f      = random_info( rng, rng() % 3 );
+
+        decoder_fcn* spec = prop_decoder_specialize( d, &f );
+        REQUIRE( prop_decoder_generic( spec ) == d );
+
+        compare_decoders( d, spec, f, random_stream( rng ) );
+    }
+
+    // qangles without a bit count aren't specialised
+    fs_info f{};
+    REQUIRE( prop_decoder_specialize( prop_decode_qangle, &f ) == prop_decode_qangle );
+}
+
+TEST_CASE( "property decoder deferred", "[property_decoder.hpp]" ) {
+    std::mt19937 rng( 1337 );
+    uint32_t deferred = 0;
+
+    for ( uint32_t run = 0; run < 2000; ++run ) {
+        decoder_fcn* d = float_generic[rng() % 6];
+        fs_info f      = random_info( rng, rng() % 3 );
+
+        convert_fcn* convert = nullptr;
+        decoder_fcn* raw     = prop_decoder_deferred( prop_decoder_specialize( d, &f ), &f, &convert );
+
+        // only fixed width quantized floats whose bits fit a cell are deferred
+        if ( !raw )
+            continue;
+
+        REQUIRE( f.quantized.fixed_width() );
+        REQUIRE( convert );
+        ++deferred;
+
+        const std::string str = random_stream( rng );
+        bitstream b1( str );
+        bitstream b2( str );
+
+        while ( b1.remaining() > 256 ) {
+            property p1, p2;
+            p1.data.quat = {{0.0f, 0.0f, 0.0f, 0.0f}};
+            p2.data.quat = {{0.0f, 0.0f, 0.0f, 0.0f}};
+
+            raw( b1, &f, &p1 );
+            convert( &f, &p1 );
+            d( b2, &f, &p2 );
+
+            REQUIRE( same_value( d, p1, p2 ) );
+            REQUIRE( b1.position() == b2.position() );
+        }
+    }
+
+    // the seed has to cover deferred decoding at all
+    REQUIRE( deferred > 100 );
+}
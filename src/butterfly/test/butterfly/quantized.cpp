@@ -0,0 +1,89 @@
+/**
+ * @file quantized.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <catch.hpp>
+#include <cstring>
+#include <random>
+#include <string>
+#include <butterfly/quantized.hpp>
+
+using namespace butterfly;
+
+/** Compares the bit patterns of two floats */
+static bool same_float( float a, float b ) { return memcmp( &a, &b, sizeof( a ) ) == 0; }
+
+/** Decodes str with the lookup table and bit by bit, both have to agree on values and positions */
+static void compare_lut( quantized_float_decoder& q, const std::string& str ) {
+    bitstream b1( str );
+    bitstream b2( str );
+
+    while ( b1.remaining() > 64 ) {
+        REQUIRE( same_float( q.decode( b1 ), q.decode_bits( b2 ) ) );
+        REQUIRE( b1.position() == b2.position() );
+    }
+}
+
+TEST_CASE( "quantized lut", "[quantized.hpp]" ) {
+    std::mt19937 rng( 1337 );
+    const float ranges[][2] = {{0.0f, 1.0f}, {-1.0f, 1.0f}, {-4096.0f, 4096.0f}, {0.0f, 360.0f}, {-100.0f, 0.0f}};
+
+    for ( uint32_t run = 0; run < 2000; ++run ) {
+        // small bit counts use the table, flags add their bits to the index
+        uint8_t bc    = 1 + rng() % 11;
+        uint8_t flags = rng() % 16;
+        auto& r       = ranges[rng() % 5];
+
+        quantized_float_decoder q( bc, flags, r[0], r[1] );
+
+        std::string str( 64 + rng() % 256, '\0' );
+        for ( auto& c : str ) {
+            c = (char)rng();
+        }
+
+        compare_lut( q, str );
+    }
+}
+
+TEST_CASE( "quantized lut flags", "[quantized.hpp]" ) {
+    std::mt19937 rng( 1337 );
+
+    // ranges around zero keep all three flag bits in front of the value
+    const uint8_t flags[] = {
+        quantized_float_decoder::QFE_ROUNDDOWN, quantized_float_decoder::QFE_ROUNDUP,
+        quantized_float_decoder::QFE_ENCODE_ZERO_EXACTLY,
+        quantized_float_decoder::QFE_ROUNDDOWN | quantized_float_decoder::QFE_ROUNDUP,
+        quantized_float_decoder::QFE_ROUNDDOWN | quantized_float_decoder::QFE_ROUNDUP |
+            quantized_float_decoder::QFE_ENCODE_ZERO_EXACTLY};
+
+    for ( auto f : flags ) {
+        for ( uint8_t bc = 1; bc <= 12; ++bc ) {
+            quantized_float_decoder q( bc, f, -13.37f, 42.0f );
+
+            // mostly set bits to hit the flag branches
+            std::string str( 256, '\0' );
+            for ( auto& c : str ) {
+                c = (char)( rng() | rng() );
+            }
+
+            compare_lut( q, str );
+        }
+    }
+}
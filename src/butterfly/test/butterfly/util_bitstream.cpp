@@ -0,0 +1,346 @@
+/**
+ * @file util_bitstream.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <catch.hpp>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <butterfly/util_bitstream.hpp>
+
+using namespace butterfly;
+
+/** Reads one bit at a time, used as reference for the bitstream */
+struct reference_reader {
+    const std::string& str;
+    uint64_t pos;
+
+    reference_reader( const std::string& s ) : str( s ), pos( 0 ) {}
+
+    uint32_t bit() {
+        uint32_t ret = ( (uint8_t)str[pos >> 3] >> ( pos & 7 ) ) & 1;
+        ++pos;
+        return ret;
+    }
+
+    uint32_t read( uint32_t n ) {
+        uint32_t ret = 0;
+        for ( uint32_t i = 0; i < n; ++i ) {
+            ret |= bit() << i;
+        }
+
+        return ret;
+    }
+
+    uint32_t readUBitVar() {
+        uint32_t ret = read( 6 );
+
+        switch ( ret & 0x30 ) {
+        case 16:
+            return ( ret & 15 ) | ( read( 4 ) << 4 );
+        case 32:
+            return ( ret & 15 ) | ( read( 8 ) << 4 );
+        case 48:
+            return ( ret & 15 ) | ( read( 28 ) << 4 );
+        }
+
+        return ret;
+    }
+
+    uint64_t readVarUInt( uint32_t max ) {
+        uint64_t ret = 0;
+        for ( uint32_t i = 0; i < max; ++i ) {
+            uint64_t b = read( 8 );
+            ret |= ( b & 0x7F ) << ( 7 * i );
+
+            if ( !( b & 0x80 ) )
+                break;
+        }
+
+        return ret;
+    }
+
+    float readCoord() {
+        float val         = 0;
+        uint32_t intval   = bit();
+        uint32_t fractval = bit();
+        bool signbit      = false;
+
+        if ( intval || fractval ) {
+            signbit = bit();
+
+            if ( intval )
+                intval = read( 14 ) + 1;
+            if ( fractval )
+                fractval = read( 5 );
+
+            val = intval + static_cast<float>( fractval ) * ( 1.0f / ( 1 << 5 ) );
+        }
+
+        return signbit ? -val : val;
+    }
+
+    float readNormal() {
+        bool signbit = bit();
+        float ret    = static_cast<float>( read( 11 ) ) * ( 1.0f / static_cast<float>( 1 << 11 ) - 1.0f );
+        return signbit ? -ret : ret;
+    }
+
+    std::array<float, 3> read3BitNormal() {
+        std::array<float, 3> ret{{0.0f, 0.0f, 0.0f}};
+
+        bool hasX = bit();
+        bool hasY = bit();
+
+        if ( hasX )
+            ret[0] = readNormal();
+        if ( hasY )
+            ret[1] = readNormal();
+
+        bool negZ     = bit();
+        float prodsum = ret[0] * ret[0] + ret[1] * ret[1];
+        ret[2]        = prodsum < 1.0f ? sqrt( 1.0 - prodsum ) : 0.0f;
+
+        if ( negZ )
+            ret[2] = -ret[2];
+
+        return ret;
+    }
+
+    int32_t readFPBitVar() {
+        if ( bit() )
+            return read( 2 );
+        if ( bit() )
+            return read( 4 );
+        if ( bit() )
+            return read( 10 );
+        if ( bit() )
+            return read( 17 );
+        return read( 31 );
+    }
+};
+
+TEST_CASE( "bitstream", "[util_bitstream.hpp]" ) {
+    std::mt19937 rng( 1337 );
+
+    for ( uint32_t run = 0; run < 100; ++run ) {
+        std::string str( 64 + rng() % 512, '\0' );
+        for ( auto& c : str ) {
+            c = (char)rng();
+        }
+
+        bitstream b( str );
+        reference_reader r( str );
+
+        // mixed reads until the stream runs out, leave room for the longest one
+        while ( b.remaining() > 64 ) {
+            switch ( rng() % 5 ) {
+            case 0: {
+                uint32_t n = 1 + rng() % 32;
+                REQUIRE( b.peek( n ) == r.read( n ) );
+                b.consume( n );
+            } break;
+            case 1: {
+                uint32_t n = 1 + rng() % 32;
+                REQUIRE( b.read( n ) == r.read( n ) );
+            } break;
+            case 2:
+                REQUIRE( b.readBool() == (bool)r.bit() );
+                break;
+            case 3:
+                REQUIRE( b.readUBitVar() == r.readUBitVar() );
+                break;
+            case 4:
+                REQUIRE( b.readFPBitVar() == r.readFPBitVar() );
+                break;
+            }
+
+            REQUIRE( b.position() == r.pos );
+        }
+
+        // bits past the end peek as zero
+        b.setPosition( b.end() );
+        REQUIRE( b.peek( 32 ) == 0 );
+    }
+}
+
+TEST_CASE( "bitstream varint", "[util_bitstream.hpp]" ) {
+    std::mt19937 rng( 1337 );
+
+    for ( uint32_t run = 0; run < 100; ++run ) {
+        // continuation bits are set most of the time to get long and overlong varints
+        std::string str( 64 + rng() % 512, '\0' );
+        for ( auto& c : str ) {
+            c = (char)( ( rng() & 0x7F ) | ( rng() % 10 < 8 ? 0x80 : 0 ) );
+        }
+
+        bitstream b( str );
+        reference_reader r( str );
+
+        while ( b.remaining() > 128 ) {
+            // byte aligned and unaligned positions
+            uint32_t skip = rng() % 2 ? rng() % 8 : 0;
+            b.read( skip );
+            r.read( skip );
+
+            if ( rng() % 2 ) {
+                REQUIRE( b.readVarUInt32() == (uint32_t)r.readVarUInt( VARINT32_MAX ) );
+            } else {
+                REQUIRE( b.readVarUInt64() == r.readVarUInt( VARINT64_MAX ) );
+            }
+
+            REQUIRE( b.position() == r.pos );
+        }
+    }
+}
+
+TEST_CASE( "bitstream bytes", "[util_bitstream.hpp]" ) {
+    std::mt19937 rng( 1337 );
+    char buf[256], ref[256];
+
+    for ( uint32_t run = 0; run < 100; ++run ) {
+        // zero bytes are rare enough for strings to span multiple blocks
+        std::string str( 512 + rng() % 512, '\0' );
+        for ( auto& c : str ) {
+            c = (char)( rng() % 64 ? 1 + rng() % 255 : 0 );
+        }
+
+        bitstream b( str );
+        reference_reader r( str );
+
+        while ( b.remaining() > 256 * 8 + 8 ) {
+            uint32_t skip = rng() % 2 ? rng() % 8 : 0;
+            b.read( skip );
+            r.read( skip );
+
+            uint32_t n = rng() % 200;
+            memset( buf, 0x55, sizeof( buf ) );
+
+            switch ( rng() % 3 ) {
+            case 0:
+                b.readBytes( buf, n );
+                for ( uint32_t i = 0; i < n; ++i ) {
+                    REQUIRE( buf[i] == (char)r.read( 8 ) );
+                }
+                break;
+            case 1: {
+                uint32_t bits = n * 8 + rng() % 8;
+                b.readBits( buf, bits );
+                for ( uint32_t i = 0; i < bits; i += 8 ) {
+                    REQUIRE( buf[i >> 3] == (char)r.read( bits - i < 8 ? bits - i : 8 ) );
+                }
+            } break;
+            case 2: {
+                uint32_t len = 0;
+                while ( len < n ) {
+                    ref[len] = (char)r.read( 8 );
+                    if ( ref[len++] == '\0' )
+                        break;
+                }
+
+                b.readString( buf, n );
+                REQUIRE( memcmp( buf, ref, len ) == 0 );
+                REQUIRE( (uint8_t)buf[n] == 0x55 );
+            } break;
+            }
+
+            REQUIRE( b.position() == r.pos );
+        }
+    }
+}
+
+TEST_CASE( "bitstream overflow", "[util_bitstream.hpp]" ) {
+    std::string str( 16, '\xff' );
+    bitstream b( str );
+    char buf[32];
+
+    // unchecked reads run past the end, check reports it
+    for ( uint32_t i = 0; i < 100; ++i ) {
+        b.read( 32 );
+    }
+
+    REQUIRE( b.position() > b.end() );
+    REQUIRE_THROWS_AS( b.check(), bitstream_overflow );
+
+    // block reads check themselves
+    b.setPosition( 8 );
+    REQUIRE_NOTHROW( b.check() );
+    REQUIRE_THROWS_AS( b.readBytes( buf, 16 ), bitstream_overflow );
+    REQUIRE_THROWS_AS( b.readString( buf, 32 ), bitstream_overflow );
+
+    b.setPosition( 8 );
+    REQUIRE_NOTHROW( b.readBytes( buf, 15 ) );
+    REQUIRE_NOTHROW( b.check() );
+}
+
+/** Wraps REPLAY_CHECK in a function, it is a statement and can't be passed to REQUIRE directly */
+static void replay_check( bool ok ) { REPLAY_CHECK( ok, "Out of range" ); }
+
+TEST_CASE( "replay corrupt", "[util_bitstream.hpp]" ) {
+    std::string str( 16, '\xff' );
+    bitstream b( str );
+    b.setPosition( 200 );
+
+    // overflows are reported as corrupt replays as well
+    REQUIRE_THROWS_AS( b.check(), replay_corrupt );
+    REQUIRE_THROWS_AS( replay_check( b.position() <= b.end() ), replay_corrupt );
+    REQUIRE_NOTHROW( replay_check( b.end() == 128 ) );
+}
+
+/** Compares the bit patterns of two floats, catches -0.0f */
+static bool same( float a, float b ) { return memcmp( &a, &b, sizeof( a ) ) == 0; }
+
+TEST_CASE( "bitstream floats", "[util_bitstream.hpp]" ) {
+    std::mt19937 rng( 1337 );
+
+    for ( uint32_t run = 0; run < 100; ++run ) {
+        // sparse bits to hit short normals that stay below 1
+        std::string str( 64 + rng() % 512, '\0' );
+        for ( auto& c : str ) {
+            c = (char)( run & 1 ? rng() : rng() & rng() & rng() );
+        }
+
+        bitstream b( str );
+        reference_reader r( str );
+
+        while ( b.remaining() > 64 ) {
+            switch ( rng() % 4 ) {
+            case 0:
+                REQUIRE( same( b.readCoord(), r.readCoord() ) );
+                break;
+            case 1:
+                REQUIRE( same( b.readNormal(), r.readNormal() ) );
+                break;
+            case 2: {
+                auto v1 = b.read3BitNormal();
+                auto v2 = r.read3BitNormal();
+                REQUIRE( ( same( v1[0], v2[0] ) && same( v1[1], v2[1] ) && same( v1[2], v2[2] ) ) );
+            } break;
+            case 3: {
+                uint32_t n = 1 + rng() % 30;
+                REQUIRE( same( b.readAngle( n ), static_cast<float>( r.read( n ) ) * 360.0f / static_cast<float>( 1 << n ) ) );
+            } break;
+            }
+
+            REQUIRE( b.position() == r.pos );
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ * @file util_huffman.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <catch.hpp>
+#include "../../private/util_huffman.hpp"
+
+using namespace butterfly;
+
+TEST_CASE( "huffman", "[util_huffman.hpp]" ) {
+    // Equal weights are merged highest node number first, the first node taken is the 0 branch
+    auto c = huffman_build( {5, 1, 1, 2} );
+
+    REQUIRE( c.size() == 4 );
+    REQUIRE( ( c[0].code == 1 && c[0].len == 1 ) );
+    REQUIRE( ( c[1].code == 1 && c[1].len == 3 ) );
+    REQUIRE( ( c[2].code == 0 && c[2].len == 3 ) );
+    REQUIRE( ( c[3].code == 1 && c[3].len == 2 ) );
+
+    // Codes are complete and prefix free
+    std::vector<uint32_t> weights;
+    for ( uint32_t i = 0; i < 40; ++i ) {
+        weights.push_back( 1 + ( i * 7919 ) % 1000 );
+    }
+
+    c = huffman_build( weights );
+
+    double kraft = 0.0;
+    for ( uint32_t i = 0; i < c.size(); ++i ) {
+        kraft += 1.0 / ( 1u << c[i].len );
+
+        for ( uint32_t j = 0; j < c.size(); ++j ) {
+            if ( i == j || c[i].len > c[j].len )
+                continue;
+
+            REQUIRE( ( c[j].code >> ( c[j].len - c[i].len ) ) != c[i].code );
+        }
+    }
+
+    REQUIRE( kraft == 1.0 );
+}
@@ -34,3 +34,10 @@ TEST_CASE( "expect", "[util_platform.hpp]" ) {
 
 // force_inline keyword
 TEST_CASE( "force_inline", "[util_platform.hpp]" ) { REQUIRE( add( 1, 2 ) == 3 ); }
+
+// ctz64
+TEST_CASE( "ctz64", "[util_platform.hpp]" ) {
+    REQUIRE( ctz64( 1ull ) == 0 );
+    REQUIRE( ctz64( 0x10ull ) == 4 );
+    REQUIRE( ctz64( 0x8000000000000000ull ) == 63 );
+}
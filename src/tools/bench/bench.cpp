@@ -0,0 +1,180 @@
+/**
+ * @file bench.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ *
+ * @par License
+ *    Butterfly Replay Parser
+ *    Copyright 2014-2016 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+
+#include <sys/resource.h>
+
+#include <butterfly/butterfly.hpp>
+#include <butterfly/entity.hpp>
+#include <butterfly/util_bitstream.hpp>
+#include <butterfly/visitor.hpp>
+
+using namespace butterfly;
+
+/** Counts entity operations */
+class bench_visitor : public visitor {
+public:
+    /** Number of entity creations / updates / deletions */
+    uint64_t ops[3] = {0, 0, 0};
+
+    void on_entity( entity_state state, entity* ent ) { ++ops[state]; }
+};
+
+/** Returns the peak resident set size in kilobytes */
+static long peak_rss() {
+    struct rusage u;
+    getrusage( RUSAGE_SELF, &u );
+    return u.ru_maxrss;
+}
+
+/** Returns the file size in bytes */
+static uint64_t file_size( const char* path ) {
+    std::ifstream f( path, std::ios::binary | std::ios::ate );
+    return f ? (uint64_t)f.tellg() : 0;
+}
+
+/** Replay decode throughput and memory */
+static int bench_replay( const char* path, uint32_t runs ) {
+    uint64_t size = file_size( path );
+    double best   = 0.0;
+
+    for ( uint32_t i = 0; i < runs; ++i ) {
+        bench_visitor v;
+        parser p;
+
+        auto start = std::chrono::steady_clock::now();
+        p.open( path );
+        p.parse_all( &v );
+        double sec = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+        // Live property storage at the end of the replay
+        uint64_t live = 0, cells = 0;
+        for ( auto e : p.entities ) {
+            if ( !e )
+                continue;
+
+            ++live;
+            cells += e->properties.size();
+        }
+
+        printf( "run %u: %.3f s, %.2f MB/s, %lu updates/s\n", i, sec, size / sec / 1048576.0,
+            (unsigned long)( ( v.ops[0] + v.ops[1] ) / sec ) );
+        printf( "       %lu live entities, %lu cells, %lu kB property storage\n", (unsigned long)live,
+            (unsigned long)cells, (unsigned long)( cells * sizeof( property ) / 1024 ) );
+
+        auto shapes     = p.shape_info();
+        uint64_t shapen = shapes.hits + shapes.misses;
+        printf( "       shape cache: %lu hits, %lu misses, %.1f%% hit rate\n", (unsigned long)shapes.hits,
+            (unsigned long)shapes.misses, shapen ? shapes.hits * 100.0 / shapen : 0.0 );
+
+        if ( best == 0.0 || sec < best )
+            best = sec;
+    }
+
+    printf( "best: %.3f s, peak rss: %ld kB\n", best, peak_rss() );
+    return 0;
+}
+
+/** Runs fn until less than margin bits remain and prints the consumed bits per nanosecond */
+template <typename F>
+static void bench_bits( const char* name, const std::string& buf, F&& fn, uint64_t margin = 64 ) {
+    bitstream b( buf );
+    uint64_t sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while ( b.remaining() > margin ) {
+        sum += fn( b );
+    }
+    double ns = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+
+    printf( "%-20s %6.3f bits/ns (%lx)\n", name, b.position() / ns, (unsigned long)sum );
+}
+
+/** Bitstream primitive throughput on random data */
+static int bench_bitstream( uint32_t mb ) {
+    std::mt19937 rng( 1337 );
+    std::string buf( mb * 1048576, '\0' );
+    for ( auto& c : buf ) {
+        c = (char)rng();
+    }
+
+    bench_bits( "read(1)", buf, []( bitstream& b ) { return b.read( 1 ); } );
+    bench_bits( "read(7)", buf, []( bitstream& b ) { return b.read( 7 ); } );
+    bench_bits( "read(17)", buf, []( bitstream& b ) { return b.read( 17 ); } );
+    bench_bits( "read(32)", buf, []( bitstream& b ) { return b.read( 32 ); } );
+    bench_bits( "peek/consume(17)", buf, []( bitstream& b ) {
+        uint32_t v = b.peek( 17 );
+        b.consume( 1 + ( v & 15 ) );
+        return v;
+    } );
+    bench_bits( "readBool", buf, []( bitstream& b ) { return b.readBool(); } );
+    bench_bits( "readUBitVar", buf, []( bitstream& b ) { return b.readUBitVar(); } );
+    bench_bits( "readFPBitVar", buf, []( bitstream& b ) { return b.readFPBitVar(); } );
+    bench_bits( "readVarUInt32", buf, []( bitstream& b ) { return b.readVarUInt32(); } );
+    bench_bits( "readVarUInt64", buf, []( bitstream& b ) { return b.readVarUInt64(); } );
+    bench_bits( "readCoord", buf, []( bitstream& b ) { return (uint64_t)b.readCoord(); } );
+    bench_bits( "readNormal", buf, []( bitstream& b ) { return (uint64_t)( b.readNormal() * 1000 ); } );
+    bench_bits( "read3BitNormal", buf, []( bitstream& b ) { return (uint64_t)( b.read3BitNormal()[2] * 1000 ); } );
+    bench_bits( "readAngle(13)", buf, []( bitstream& b ) { return (uint64_t)b.readAngle( 13 ); } );
+
+    // packet sized copies and strings, string lengths follow the zero bytes in the random data
+    static char out[4096];
+    bench_bits( "readBytes(4096)", buf, []( bitstream& b ) {
+        b.readBytes( out, sizeof( out ) );
+        return out[0];
+    }, sizeof( out ) * 8 + 8 );
+    bench_bits( "readBytes(4096)+1", buf, []( bitstream& b ) {
+        b.read( 1 );
+        b.readBytes( out, sizeof( out ) );
+        return out[0];
+    }, sizeof( out ) * 8 + 8 );
+    bench_bits( "readString", buf, []( bitstream& b ) {
+        b.readString( out, sizeof( out ) );
+        return out[0];
+    }, sizeof( out ) * 8 + 8 );
+    bench_bits( "readString+1", buf, []( bitstream& b ) {
+        b.read( 1 );
+        b.readString( out, sizeof( out ) );
+        return out[0];
+    }, sizeof( out ) * 8 + 8 );
+    return 0;
+}
+
+int main( int argc, char** argv ) {
+    if ( argc < 2 ) {
+        printf( "Usage: bench <replay> [runs]\n" );
+        printf( "       bench --bits [MB]\n" );
+        return 1;
+    }
+
+    if ( strcmp( argv[1], "--bits" ) == 0 )
+        return bench_bitstream( argc > 2 ? atoi( argv[2] ) : 64 );
+
+    uint32_t runs = argc > 2 ? atoi( argv[2] ) : 1;
+    return bench_replay( argv[1], runs );
+}